@@ -0,0 +1,39 @@
+#ifndef CTOOLS_ALLOC_H
+#define CTOOLS_ALLOC_H
+
+#include <stdlib.h>
+
+/**
+ * Allocator hooks, used by every container in ctools instead of calling malloc(), realloc() and free() directly.
+ *
+ * Define any of the macros below before including a ctools header to route its allocations elsewhere,
+ * e.g. to a per-request arena or a NUMA-local allocator. The hooks are told the size of every block they free
+ * or reallocate, so allocators that do not track sizes themselves can be plugged in as well.
+ *
+ * `ctx` is whatever CTOOLS_ALLOC_CTX expands to at the call site, e.g. a thread-local pointer to the current arena.
+ *
+ * The trie, the rtree, ct_cbuf_pool, ct_pool and ct_uring are compiled into the library, so they only see hooks
+ * that are defined when the library is built. Point the CTOOLS_ALLOC_HEADER build option at a header that defines them.
+ */
+
+#ifdef CTOOLS_ALLOC_HEADER
+#include CTOOLS_ALLOC_HEADER
+#endif
+
+#ifndef CTOOLS_ALLOC_CTX
+#define CTOOLS_ALLOC_CTX NULL
+#endif
+
+#ifndef CTOOLS_ALLOC
+#define CTOOLS_ALLOC(ctx, size) ((void) (ctx), malloc(size))
+#endif
+
+#ifndef CTOOLS_REALLOC
+#define CTOOLS_REALLOC(ctx, ptr, old_size, new_size) ((void) (ctx), (void) (old_size), realloc((ptr), (new_size)))
+#endif
+
+#ifndef CTOOLS_FREE
+#define CTOOLS_FREE(ctx, ptr, size) ((void) (ctx), (void) (size), free(ptr))
+#endif
+
+#endif // CTOOLS_ALLOC_H
@@ -1,6 +1,23 @@
 #ifndef CTOOLS_CIRCULAR_BUFFER_IN_LINUX
 #define CTOOLS_CIRCULAR_BUFFER_IN_LINUX
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef CT_CBUF_INDEX
+// The type of the capacity and the indices of a circular buffer. Both indices address the doubled address space,
+// which limits the capacity to half of the range of this type. Define as `uint64_t` for rings of 2 GiB or more,
+// both when building ctools and when including this header (see the CTOOLS_CBUF_64BIT_INDEX build option).
+#define CT_CBUF_INDEX unsigned int
+#endif
+
+// Back the buffer with 2 MiB huge pages, when the system has them to spare.
+#define CT_CBUF_HUGE_2MB (1 << 0)
+
+// Back the buffer with 1 GiB huge pages, when the system has them to spare.
+#define CT_CBUF_HUGE_1GB (1 << 1)
+
 /**
  * A circular buffer.
  * 
@@ -15,15 +32,106 @@
 struct ct_cbuf {
     void* buffer;
     int memfd;
-    unsigned int capacity;
-    unsigned int head;
-    unsigned int tail;
+    CT_CBUF_INDEX capacity;
+    CT_CBUF_INDEX head;
+    CT_CBUF_INDEX tail;
+    size_t page_size;
+
+    // The header page of a file-backed buffer, or NULL. See ct_cbuf_init_file().
+    void* journal;
 };
 
-int ct_cbuf_init(struct ct_cbuf* cbuf, const unsigned int min_capacity);
+int ct_cbuf_init(struct ct_cbuf* cbuf, const CT_CBUF_INDEX min_capacity);
+
+/**
+ * @brief Initializes a circular buffer with a choice of backing pages.
+ *
+ * Huge pages cut the TLB misses of large buffers. When both huge page flags are given, 1 GiB pages are tried first.
+ * If the system has no huge pages of the requested sizes to spare, the buffer falls back to normal pages.
+ * The capacity is rounded up to the page size actually used, which is reported in `page_size`.
+ *
+ * @param cbuf The circular buffer to initialize.
+ * @param min_capacity The minimum number of bytes the buffer must be able to hold.
+ * @param flags A combination of `CT_CBUF_HUGE_2MB` and `CT_CBUF_HUGE_1GB`, or 0 for normal pages.
+ * @return 0 on success, or -1 on error.
+ */
+int ct_cbuf_init_ex(struct ct_cbuf* cbuf, const CT_CBUF_INDEX min_capacity, const int flags);
+
+/**
+ * @brief Initializes a circular buffer backed by a regular file, which turns it into a persistent journal.
+ *
+ * The file holds a header page, followed by the data. When the file is empty, it is sized for a new buffer of
+ * at least @p min_capacity bytes. Otherwise the buffer is recovered from the header, with the capacity, head and tail
+ * that were stored by the last ct_cbuf_sync(), and @p min_capacity is ignored. Recovery only maps the file again,
+ * no data is read or copied.
+ *
+ * Appends are plain stores to the mapped file, so nothing reaches the disk before ct_cbuf_sync() is called.
+ * Data written since then is lost on a crash, but the buffer never recovers with a head that points past
+ * data that did not make it to the disk.
+ *
+ * @param cbuf The circular buffer to initialize.
+ * @param fd A regular file, opened for reading and writing. It is duplicated, so the caller keeps ownership of it.
+ * @param min_capacity The minimum number of bytes a new buffer must be able to hold.
+ * @return 0 on success, or -1 on error with errno set. Fails with EINVAL if the file holds something else.
+ */
+int ct_cbuf_init_file(struct ct_cbuf* cbuf, int fd, const CT_CBUF_INDEX min_capacity);
+
+/**
+ * @brief Makes all data of a file-backed buffer durable, then stores its head and tail in the header.
+ *
+ * Meant to be called once per batch of appends rather than after each of them, since it waits for the disk.
+ *
+ * @return 0 on success, or -1 on error with errno set. Fails with EINVAL if the buffer is not file-backed.
+ */
+int ct_cbuf_sync(struct ct_cbuf* cbuf);
+
+/**
+ * @brief Starts writing back the data of a file-backed buffer without waiting for it.
+ *
+ * Spreads the disk writes over time, so the next ct_cbuf_sync() has less left to wait for.
+ * Does not update the header.
+ *
+ * @return 0 on success, or -1 on error with errno set. Fails with EINVAL if the buffer is not file-backed.
+ */
+int ct_cbuf_sync_start(struct ct_cbuf* cbuf);
 
+/**
+ * @brief Destroys a circular buffer. File-backed buffers are synced first, see ct_cbuf_sync().
+ */
 void ct_cbuf_exit(struct ct_cbuf* cbuf);
 
+/**
+ * @brief Increases the capacity of a circular buffer, keeping its content.
+ *
+ * The memfd is extended and mapped again at a new address, so `buffer` changes, and pointers into the old
+ * mapping become invalid. The pages that hold data are not copied as long as the data does not wrap around
+ * the end of the old capacity.
+ *
+ * When it does wrap, this is not free: one of the two parts of the data is copied next to the other one,
+ * because the memfd stays a plain mirror of its file offsets, which ct_cbuf_shrink(), later grows, and other
+ * processes mapping the memfd rely on. The shorter part is copied, which is at most half of the data,
+ * unless the capacity grows by less than that part, in which case the longer part is moved instead.
+ * Growing while the buffer is empty, or well before it fills up, avoids the copy.
+ *
+ * @param cbuf Pointer to the circular buffer structure
+ * @param min_capacity The minimum number of bytes the buffer must be able to hold
+ * @return 0 on success, or -1 on error with errno set. The buffer is left untouched on error.
+ *         Fails with EPERM for file-backed buffers and for buffers handed out by a ct_cbuf_pool.
+ */
+int ct_cbuf_grow(struct ct_cbuf* cbuf, const CT_CBUF_INDEX min_capacity);
+
+/**
+ * @brief Decreases the capacity of an empty circular buffer, giving the memory beyond it back to the system.
+ *
+ * Like ct_cbuf_grow(), this moves the buffer to a new address.
+ *
+ * @param cbuf Pointer to the circular buffer structure
+ * @param min_capacity The minimum number of bytes the buffer must still be able to hold
+ * @return 0 on success, or -1 on error with errno set. Fails with EBUSY if the buffer is not empty,
+ *         and with EPERM for file-backed buffers and for buffers handed out by a ct_cbuf_pool.
+ */
+int ct_cbuf_shrink(struct ct_cbuf* cbuf, const CT_CBUF_INDEX min_capacity);
+
 /**
  * @brief Reads data from a circular buffer.
  *
@@ -37,7 +145,7 @@ void ct_cbuf_exit(struct ct_cbuf* cbuf);
  * @note The caller is responsible for ensuring that @p dst points to
  *       a valid buffer with sufficient space to hold @p read_count bytes.
  */
-int ct_cbuf_read(struct ct_cbuf* cbuf, void* dst, unsigned int read_count);
+ssize_t ct_cbuf_read(struct ct_cbuf* cbuf, void* dst, CT_CBUF_INDEX read_count);
 
 /**
  * @brief Writes data to a circular buffer
@@ -46,10 +154,302 @@ int ct_cbuf_read(struct ct_cbuf* cbuf, void* dst, unsigned int read_count);
  * @param write_count Number of bytes to write
  * @return Number of bytes successfully written, or negative value on error
  */
-int ct_cbuf_write(struct ct_cbuf* cbuf, const void* src, const unsigned int write_count);
+ssize_t ct_cbuf_write(struct ct_cbuf* cbuf, const void* src, const CT_CBUF_INDEX write_count);
+
+/**
+ * @brief Gets a pointer to the free space at the head of a circular buffer.
+ *
+ * Thanks to the doubled address space, the returned region is always contiguous,
+ * which lets the caller produce data directly into the buffer instead of through a staging copy.
+ * Nothing becomes readable until it is published with ct_cbuf_write_commit().
+ *
+ * @param[in] cbuf Pointer to the circular buffer structure.
+ * @param[out] available Set to the number of bytes that may be written to the returned pointer. May be NULL.
+ * @return A pointer to the head of the circular buffer.
+ */
+void* ct_cbuf_write_reserve(struct ct_cbuf* cbuf, CT_CBUF_INDEX* available);
+
+/**
+ * @brief Publishes bytes written through the pointer returned by ct_cbuf_write_reserve().
+ * @param cbuf Pointer to the circular buffer structure
+ * @param write_count Number of bytes to publish
+ * @return 0 on success, or -1 if @p write_count exceeds the space left in the buffer
+ */
+int ct_cbuf_write_commit(struct ct_cbuf* cbuf, const CT_CBUF_INDEX write_count);
+
+/**
+ * @brief Gets a pointer to the occupied space at the tail of a circular buffer.
+ *
+ * The returned region is always contiguous, so the data can be decoded in place.
+ * The bytes stay in the buffer until they are released with ct_cbuf_consume().
+ *
+ * @param[in] cbuf Pointer to the circular buffer structure.
+ * @param[out] available Set to the number of bytes that may be read from the returned pointer. May be NULL.
+ * @return A pointer to the tail of the circular buffer.
+ */
+const void* ct_cbuf_peek(const struct ct_cbuf* cbuf, CT_CBUF_INDEX* available);
+
+/**
+ * @brief Releases bytes at the tail of a circular buffer, typically after inspecting them with ct_cbuf_peek().
+ * @param cbuf Pointer to the circular buffer structure
+ * @param read_count Number of bytes to release
+ * @return 0 on success, or -1 if @p read_count exceeds the space occupied in the buffer
+ */
+int ct_cbuf_consume(struct ct_cbuf* cbuf, const CT_CBUF_INDEX read_count);
+
+/**
+ * @brief Reads from a file descriptor straight into the free space of a circular buffer.
+ *
+ * The free space is always contiguous, so a single `read()` covers all of it, and no bounce buffer is involved.
+ *
+ * @param cbuf Pointer to the circular buffer structure
+ * @param fd The file descriptor to read from, e.g. a socket or a pipe
+ * @return The number of bytes read, 0 on end-of-file, or -1 on error with errno set.
+ *         Fails with ENOBUFS if the buffer is full.
+ */
+ssize_t ct_cbuf_fill_from_fd(struct ct_cbuf* cbuf, int fd);
+
+/**
+ * @brief Writes the occupied space of a circular buffer straight to a file descriptor.
+ *
+ * The occupied space is always contiguous, so a single `write()` covers all of it.
+ * Only the bytes accepted by the file descriptor are removed from the buffer.
+ *
+ * @param cbuf Pointer to the circular buffer structure
+ * @param fd The file descriptor to write to, e.g. a socket or a pipe
+ * @return The number of bytes written, or -1 on error with errno set.
+ */
+ssize_t ct_cbuf_drain_to_fd(struct ct_cbuf* cbuf, int fd);
+
+/**
+ * @brief Moves data from a pipe into the free space of a circular buffer with `splice()`.
+ *
+ * The kernel copies the pipe's pages straight into the memfd, so the data never passes through user space.
+ * A transfer stops at the end of the memfd, so the call may have to be repeated when the free space wraps around.
+ * Falls back to `read()` for huge page buffers, whose memfd cannot be spliced into, and for pooled buffers.
+ *
+ * @param cbuf Pointer to the circular buffer structure
+ * @param pipe_fd The read end of a pipe, e.g. one that a socket was spliced into
+ * @param tap_fd The write end of a pipe that receives a copy of the data through `tee()`, or -1.
+ *               Only as many bytes as fit into the tap are moved, and the tap is never waited for.
+ *               All of the bytes that reached the tap are moved into the buffer, so each byte is teed once.
+ * @return The number of bytes moved, 0 on end-of-file, or -1 on error with errno set.
+ *         Fails with ENOBUFS if the buffer is full, and with EAGAIN if the tap is full.
+ */
+ssize_t ct_cbuf_splice_in(struct ct_cbuf* cbuf, int pipe_fd, int tap_fd);
+
+/**
+ * @brief Moves the occupied space of a circular buffer into a pipe with `vmsplice()`.
+ *
+ * The pipe takes references to the pages of the buffer instead of copying them, and the occupied space
+ * is always contiguous, so a single call covers all of it. The bytes are consumed right away, but they stay
+ * in the pipe as references to the buffer. Empty the pipe, e.g. by splicing it into a socket or a file,
+ * before writing to the buffer again. Otherwise the new data may show up in the pipe in place of the old.
+ *
+ * @param cbuf Pointer to the circular buffer structure
+ * @param pipe_fd The write end of a pipe
+ * @return The number of bytes moved, or -1 on error with errno set.
+ */
+ssize_t ct_cbuf_splice_out(struct ct_cbuf* cbuf, int pipe_fd);
+
+CT_CBUF_INDEX ct_cbuf_space_left(const struct ct_cbuf* cbuf);
+
+CT_CBUF_INDEX ct_cbuf_space_occupied(const struct ct_cbuf* cbuf);
+
+
+
+
+#ifndef CT_CBUF_CACHE_LINE
+#define CT_CBUF_CACHE_LINE 64
+#endif
+
+/**
+ * One side's index of a ct_cbuf_spsc.
+ *
+ * Only the owning side writes to this cache line. The other side reads `value` with acquire semantics,
+ * while `cached` is the owner's private copy of the opposite index, refreshed only when it runs out of room.
+ *
+ * `wake` is the futex word that the other side sleeps on, bumped by the owner whenever it moves `value`
+ * while `sleeping` is set on the other side's line. `sleeping` is set while the owner waits for the other side.
+ */
+struct ct_cbuf_spsc_index {
+    CT_CBUF_INDEX value;
+    CT_CBUF_INDEX cached;
+    uint32_t wake;
+    uint32_t sleeping;
+} __attribute__((aligned(CT_CBUF_CACHE_LINE)));
+
+/**
+ * The control page in front of the data of a ct_cbuf_spsc.
+ *
+ * Lives in the memfd itself, so every process that maps the memfd shares the indices.
+ * The layout fields let a process that attaches to the memfd re-create the doubled mapping.
+ */
+struct ct_cbuf_spsc_control {
+    uint32_t magic;
+    uint32_t index_size;
+    uint64_t capacity;
+    uint64_t page_size;
+
+    struct ct_cbuf_spsc_index producer;
+    struct ct_cbuf_spsc_index consumer;
+};
+
+/**
+ * A lock-free circular buffer for exactly one producer thread and one consumer thread.
+ *
+ * Uses the same doubled address space as `struct ct_cbuf`, while the head and tail live on separate cache lines
+ * in a control page mapped in front of the data. The producer may only call the write functions,
+ * and the consumer may only call the read functions. Either side may query the space functions.
+ *
+ * The two sides may also live in different processes, see ct_cbuf_spsc_export() and ct_cbuf_spsc_attach().
+ */
+struct ct_cbuf_spsc {
+    void* buffer;
+    int memfd;
+    CT_CBUF_INDEX capacity;
+    struct ct_cbuf_spsc_control* control;
+    size_t page_size;
+
+    // Signalled by the producer, or -1. See ct_cbuf_spsc_eventfd().
+    int eventfd;
+};
+
+int ct_cbuf_spsc_init(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX min_capacity);
+
+/**
+ * @brief Same as ct_cbuf_init_ex(), for a single-producer/single-consumer buffer.
+ */
+int ct_cbuf_spsc_init_ex(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX min_capacity, const int flags);
+
+void ct_cbuf_spsc_exit(struct ct_cbuf_spsc* cbuf);
+
+/**
+ * @brief Sends the memfd of a buffer to another process over a Unix domain socket.
+ *
+ * The receiving process calls ct_cbuf_spsc_attach() to map the same buffer, after which the two processes
+ * may act as the producer and the consumer of it. The buffer stays alive until both sides have called
+ * ct_cbuf_spsc_exit().
+ *
+ * @param cbuf The buffer to share.
+ * @param sock A connected `AF_UNIX` socket.
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_cbuf_spsc_export(const struct ct_cbuf_spsc* cbuf, int sock);
+
+/**
+ * @brief Receives a memfd sent by ct_cbuf_spsc_export(), and maps the buffer behind it.
+ * @param cbuf The buffer to initialize.
+ * @param sock A connected `AF_UNIX` socket.
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_cbuf_spsc_attach(struct ct_cbuf_spsc* cbuf, int sock);
+
+/**
+ * @brief Maps the buffer behind a memfd that was obtained by other means than ct_cbuf_spsc_attach().
+ *
+ * Takes ownership of @p fd, which is closed by ct_cbuf_spsc_exit(), or right away on error.
+ * Fails with EINVAL if @p fd is not the memfd of a buffer built with the same `CT_CBUF_INDEX`.
+ *
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_cbuf_spsc_attach_fd(struct ct_cbuf_spsc* cbuf, int fd);
+
+/**
+ * @brief Reads data from a single-producer/single-consumer circular buffer. Consumer side only.
+ * @return The number of bytes actually read from the circular buffer.
+ */
+ssize_t ct_cbuf_spsc_read(struct ct_cbuf_spsc* cbuf, void* dst, CT_CBUF_INDEX read_count);
+
+/**
+ * @brief Writes data to a single-producer/single-consumer circular buffer. Producer side only.
+ * @return Number of bytes successfully written, or -1 if there is not enough space left.
+ */
+ssize_t ct_cbuf_spsc_write(struct ct_cbuf_spsc* cbuf, const void* src, const CT_CBUF_INDEX write_count);
+
+/**
+ * @brief Gets a pointer to the free space at the head of the buffer. Producer side only.
+ *
+ * The consumer's index is only re-read when the cached copy shows less than @p min_count bytes of free space,
+ * so @p available may under-report the free space when the consumer has caught up in the meantime.
+ *
+ * @param[in] cbuf Pointer to the circular buffer structure.
+ * @param[in] min_count The number of bytes the caller needs.
+ * @param[out] available Set to the number of bytes that may be written to the returned pointer. May be NULL.
+ * @return A pointer to the head of the circular buffer, or NULL if fewer than @p min_count bytes are free.
+ */
+void* ct_cbuf_spsc_write_reserve(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX min_count, CT_CBUF_INDEX* available);
+
+/**
+ * @brief Publishes bytes written through the pointer returned by ct_cbuf_spsc_write_reserve(). Producer side only.
+ * @return 0 on success, or -1 if @p write_count exceeds the space left in the buffer
+ */
+int ct_cbuf_spsc_write_commit(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX write_count);
+
+/**
+ * @brief Gets a pointer to the occupied space at the tail of the buffer. Consumer side only.
+ *
+ * The producer's index is only re-read when the cached copy shows less than @p min_count bytes of data.
+ *
+ * @param[in] cbuf Pointer to the circular buffer structure.
+ * @param[in] min_count The number of bytes the caller needs.
+ * @param[out] available Set to the number of bytes that may be read from the returned pointer. May be NULL.
+ * @return A pointer to the tail of the circular buffer, or NULL if fewer than @p min_count bytes are available.
+ */
+const void* ct_cbuf_spsc_peek(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX min_count, CT_CBUF_INDEX* available);
+
+/**
+ * @brief Releases bytes at the tail of the buffer back to the producer. Consumer side only.
+ * @return 0 on success, or -1 if @p read_count exceeds the space occupied in the buffer
+ */
+int ct_cbuf_spsc_consume(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX read_count);
+
+/**
+ * @brief Blocks until at least @p min_count bytes can be read. Consumer side only.
+ *
+ * Spins for a short while first, so a consumer that keeps up with the producer never enters the kernel.
+ * After that it sleeps on a futex in the control page, which the producer wakes from ct_cbuf_spsc_write_commit()
+ * only when a waiter is present. Works the same when the producer lives in another process.
+ *
+ * @param timeout_ms The longest time to wait, or a negative value to wait forever. 0 only checks once.
+ * @return 0 once the data is available, or -1 with errno set to ETIMEDOUT, or to EINVAL if @p min_count
+ *         exceeds the capacity.
+ */
+int ct_cbuf_spsc_wait_readable(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX min_count, int timeout_ms);
+
+/**
+ * @brief Blocks until at least @p min_count bytes can be written. Producer side only.
+ *
+ * The counterpart of ct_cbuf_spsc_wait_readable(), woken by ct_cbuf_spsc_consume().
+ */
+int ct_cbuf_spsc_wait_writable(struct ct_cbuf_spsc* cbuf, const CT_CBUF_INDEX min_count, int timeout_ms);
+
+/**
+ * @brief Gets an eventfd that becomes readable whenever the buffer goes from empty to non-empty.
+ *
+ * Lets the consumer sit in an epoll set next to other file descriptors. Once the eventfd is readable,
+ * the consumer has to read it to reset it, and then drain the buffer until it is empty.
+ * Otherwise it would miss data that arrived while it was still non-empty.
+ *
+ * The eventfd is created on the first call and closed by ct_cbuf_spsc_exit(). It belongs to this struct,
+ * so it only works when the producer and the consumer share the struct, i.e. live in the same process.
+ *
+ * @return The eventfd, or -1 on error with errno set.
+ */
+int ct_cbuf_spsc_eventfd(struct ct_cbuf_spsc* cbuf);
+
+/**
+ * @brief Same as ct_cbuf_fill_from_fd(), for a single-producer/single-consumer buffer. Producer side only.
+ */
+ssize_t ct_cbuf_spsc_fill_from_fd(struct ct_cbuf_spsc* cbuf, int fd);
+
+/**
+ * @brief Same as ct_cbuf_drain_to_fd(), for a single-producer/single-consumer buffer. Consumer side only.
+ */
+ssize_t ct_cbuf_spsc_drain_to_fd(struct ct_cbuf_spsc* cbuf, int fd);
 
-unsigned int ct_cbuf_space_left(const struct ct_cbuf* cbuf);
+CT_CBUF_INDEX ct_cbuf_spsc_space_left(const struct ct_cbuf_spsc* cbuf);
 
-unsigned int ct_cbuf_space_occupied(const struct ct_cbuf* cbuf);
+CT_CBUF_INDEX ct_cbuf_spsc_space_occupied(const struct ct_cbuf_spsc* cbuf);
 
 #endif // CTOOLS_CIRCULAR_BUFFER_IN_LINUX
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef CTOOLS_CIRCULAR_BUFFER_MPSC
+#define CTOOLS_CIRCULAR_BUFFER_MPSC
+
+#include <stdint.h>
+
+#include "ctools/cbuf.h"
+
+/**
+ * A record-oriented circular buffer for any number of producer threads and one consumer thread.
+ *
+ * Producers reserve length-prefixed frames by advancing the shared head with a compare-and-swap,
+ * fill them in place, and publish each of them with ct_cbuf_mpsc_commit(). Producers never wait for each other,
+ * apart from retrying the compare-and-swap. The consumer hands whole frames to a callback, in reservation order,
+ * and stops at the first frame that has not been committed yet.
+ *
+ * Frames are stored in the doubled address space of a `struct ct_cbuf`, so a frame never has to be split
+ * at the end of the buffer. The capacity is rounded up to a power of two, which lets the indices run freely.
+ */
+struct ct_cbuf_mpsc {
+    struct ct_cbuf ring;
+
+    // Reserved by the producers
+    CT_CBUF_INDEX head __attribute__((aligned(CT_CBUF_CACHE_LINE)));
+
+    // Released by the consumer
+    CT_CBUF_INDEX tail __attribute__((aligned(CT_CBUF_CACHE_LINE)));
+};
+
+/**
+ * Called by ct_cbuf_mpsc_read() for each committed frame.
+ * The payload is released back to the producers once the batch is done.
+ */
+typedef void (*ct_cbuf_mpsc_handler)(void* context, const void* payload, uint32_t length);
+
+int ct_cbuf_mpsc_init(struct ct_cbuf_mpsc* cbuf, const CT_CBUF_INDEX min_capacity);
+
+void ct_cbuf_mpsc_exit(struct ct_cbuf_mpsc* cbuf);
+
+/**
+ * @brief Reserves a frame. Safe to call from any number of threads.
+ * @param cbuf Pointer to the circular buffer structure
+ * @param length The size of the payload of the frame, in bytes
+ * @return A pointer to the contiguous payload of the frame, or NULL if there is not enough space left.
+ */
+void* ct_cbuf_mpsc_reserve(struct ct_cbuf_mpsc* cbuf, const uint32_t length);
+
+/**
+ * @brief Publishes a frame reserved with ct_cbuf_mpsc_reserve() to the consumer.
+ * @param cbuf Pointer to the circular buffer structure
+ * @param payload The pointer returned by ct_cbuf_mpsc_reserve()
+ */
+void ct_cbuf_mpsc_commit(struct ct_cbuf_mpsc* cbuf, void* payload);
+
+/**
+ * @brief Copies a payload into a new frame and publishes it. Safe to call from any number of threads.
+ * @return 0 on success, or -1 if there is not enough space left.
+ */
+int ct_cbuf_mpsc_write(struct ct_cbuf_mpsc* cbuf, const void* payload, const uint32_t length);
+
+/**
+ * @brief Hands a batch of committed frames to @p handler, then releases them. Consumer thread only.
+ * @param cbuf Pointer to the circular buffer structure
+ * @param handler Called once for each frame, in the order the frames were reserved
+ * @param context Passed on to @p handler
+ * @param max_frames The maximum number of frames to read
+ * @return The number of frames read.
+ */
+unsigned int ct_cbuf_mpsc_read(struct ct_cbuf_mpsc* cbuf, ct_cbuf_mpsc_handler handler, void* context, const unsigned int max_frames);
+
+#endif // CTOOLS_CIRCULAR_BUFFER_MPSC
@@ -0,0 +1,76 @@
+#ifndef CTOOLS_CIRCULAR_BUFFER_POOL
+#define CTOOLS_CIRCULAR_BUFFER_POOL
+
+#include "ctools/cbuf.h"
+
+// Zero the data of a circular buffer when it is released to the pool
+#define CT_CBUF_POOL_ZERO    (1 << 0)
+// Hand the pages of a circular buffer back to the kernel when it is released to the pool
+#define CT_CBUF_POOL_DISCARD (1 << 1)
+
+/**
+ * A fixed set of circular buffers of the same capacity, created up front.
+ *
+ * All buffers share one memfd and one reservation of address space, and every buffer is mapped
+ * into its own doubled slot once, when the pool is initialized. Acquiring and releasing a buffer
+ * only pops and pushes an index, so no system call is made per buffer unless CT_CBUF_POOL_DISCARD is set.
+ *
+ * The buffers handed out by a pool have no memfd of their own. They must not be passed to
+ * ct_cbuf_exit(), ct_cbuf_grow() or ct_cbuf_shrink(), and must be released to the pool they came from.
+ *
+ * Not thread-safe.
+ */
+struct ct_cbuf_pool {
+    int memfd;
+    void* reservation;
+    size_t reservation_size;
+
+    CT_CBUF_INDEX capacity;
+    unsigned int count;
+    int flags;
+
+    struct ct_cbuf* cbufs;
+
+    // The indices of the released buffers, used as a stack
+    unsigned int* free;
+    unsigned int free_count;
+
+    unsigned int high_water;
+};
+
+struct ct_cbuf_pool_stats {
+    // The number of buffers in the pool
+    unsigned int count;
+    // The number of buffers currently handed out
+    unsigned int in_use;
+    // The largest number of buffers handed out at the same time
+    unsigned int high_water;
+};
+
+/**
+ * @brief Creates @p count circular buffers that each hold at least @p min_capacity bytes.
+ * @param flags Any combination of CT_CBUF_POOL_ZERO and CT_CBUF_POOL_DISCARD, or 0.
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_cbuf_pool_init(struct ct_cbuf_pool* pool, const unsigned int count, const CT_CBUF_INDEX min_capacity, const int flags);
+
+/**
+ * @brief Destroys the pool and all of its circular buffers, whether they were released or not.
+ */
+void ct_cbuf_pool_exit(struct ct_cbuf_pool* pool);
+
+/**
+ * @brief Takes an empty circular buffer out of the pool.
+ * @return The circular buffer, or NULL if all of them are in use.
+ */
+struct ct_cbuf* ct_cbuf_pool_acquire(struct ct_cbuf_pool* pool);
+
+/**
+ * @brief Returns a circular buffer obtained with ct_cbuf_pool_acquire() to the pool.
+ * @return 0 on success, or -1 if @p cbuf does not belong to the pool or has already been released.
+ */
+int ct_cbuf_pool_release(struct ct_cbuf_pool* pool, struct ct_cbuf* cbuf);
+
+void ct_cbuf_pool_stats(const struct ct_cbuf_pool* pool, struct ct_cbuf_pool_stats* stats);
+
+#endif // CTOOLS_CIRCULAR_BUFFER_POOL
@@ -0,0 +1,227 @@
+#ifndef DEQUE_TYPE
+#error "DEQUE_TYPE must be defined before including deque.h"
+#endif
+#ifndef DEQUE_NAME
+#error "DEQUE_NAME must be defined before including deque.h"
+#endif
+
+#ifndef DEQUE_MIN_CAPACITY
+#define DEQUE_MIN_CAPACITY 32
+#endif
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ctools/alloc.h"
+#include "ctools/define_concat.h"
+
+
+
+// typedef struct DEQUE_NAME DEQUE_NAME;
+
+// int __EXPAND_CONCAT(DEQUE_NAME,_create)(DEQUE_NAME* d, const int64_t initial_capacity);
+// int64_t __EXPAND_CONCAT(DEQUE_NAME,_size)(DEQUE_NAME* d);
+// int __EXPAND_CONCAT(DEQUE_NAME,_push)(DEQUE_NAME* d, DEQUE_TYPE value);  // Owner thread only
+// int __EXPAND_CONCAT(DEQUE_NAME,_pop)(DEQUE_NAME* d, DEQUE_TYPE* dst);    // Owner thread only
+// int __EXPAND_CONCAT(DEQUE_NAME,_steal)(DEQUE_NAME* d, DEQUE_TYPE* dst);  // Any thread
+// void __EXPAND_CONCAT(DEQUE_NAME,_destroy)(DEQUE_NAME* d);
+
+
+
+// A Chase-Lev work-stealing deque.
+//
+// One thread owns the deque, and pushes and pops at the bottom end without any compare-and-swap,
+// except when it takes the last element. Any number of other threads steal from the top end, and race
+// each other with a compare-and-swap on `top`. The indices only ever grow, so `top` cannot suffer from ABA.
+//
+// The elements live in a circular array, which the owner replaces with one of twice the size when it is full.
+// A thief may still be reading from the array that was replaced, so replaced arrays are kept until `_destroy`.
+// They add up to less than the size of the current array.
+//
+// Elements are copied in and out with atomic loads and stores. Types larger than 8 bytes need libatomic.
+
+typedef struct __EXPAND_CONCAT(DEQUE_NAME,_array) {
+    int64_t capacity_mask;
+
+    // The array that this one replaced, or NULL
+    struct __EXPAND_CONCAT(DEQUE_NAME,_array)* previous;
+
+    DEQUE_TYPE buffer[];
+} __EXPAND_CONCAT(DEQUE_NAME,_array);
+
+typedef struct DEQUE_NAME {
+    // Taken by the thieves, and by the owner when it pops the last element
+    int64_t top __attribute__((aligned(64)));
+
+    // Only written by the owner
+    int64_t bottom __attribute__((aligned(64)));
+    __EXPAND_CONCAT(DEQUE_NAME,_array)* array;
+} DEQUE_NAME;
+
+static inline __EXPAND_CONCAT(DEQUE_NAME,_array)* __EXPAND_CONCAT(DEQUE_NAME,_array_create)(const int64_t capacity) {
+    __EXPAND_CONCAT(DEQUE_NAME,_array)* a = (__EXPAND_CONCAT(DEQUE_NAME,_array)*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX,
+        sizeof(__EXPAND_CONCAT(DEQUE_NAME,_array)) + capacity * sizeof(DEQUE_TYPE));
+
+    if (!a)
+        return NULL;
+
+    a->capacity_mask = capacity - 1;
+    a->previous = NULL;
+
+    return a;
+}
+
+static inline void __EXPAND_CONCAT(DEQUE_NAME,_array_destroy)(__EXPAND_CONCAT(DEQUE_NAME,_array)* a) {
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, a, sizeof(__EXPAND_CONCAT(DEQUE_NAME,_array)) + (a->capacity_mask + 1) * sizeof(DEQUE_TYPE));
+}
+
+static inline DEQUE_TYPE __EXPAND_CONCAT(DEQUE_NAME,_array_get)(__EXPAND_CONCAT(DEQUE_NAME,_array)* a, const int64_t index) {
+    DEQUE_TYPE value;
+    __atomic_load(&a->buffer[index & a->capacity_mask], &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+static inline void __EXPAND_CONCAT(DEQUE_NAME,_array_set)(__EXPAND_CONCAT(DEQUE_NAME,_array)* a, const int64_t index, DEQUE_TYPE value) {
+    __atomic_store(&a->buffer[index & a->capacity_mask], &value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Initializes a deque.
+ * @param initial_capacity The number of elements that fit before the array has to grow.
+ *        The largest of this and DEQUE_MIN_CAPACITY is rounded up to a power of two.
+ * @return 0 on success, or -3 if the array could not be allocated.
+ */
+static inline int __EXPAND_CONCAT(DEQUE_NAME,_create)(DEQUE_NAME* d, const int64_t initial_capacity) {
+    int64_t capacity = 1;
+    while (capacity < initial_capacity || capacity < DEQUE_MIN_CAPACITY)
+        capacity <<= 1;
+
+    d->array = __EXPAND_CONCAT(DEQUE_NAME,_array_create)(capacity);
+    if (!d->array)
+        return -3;
+
+    d->top = 0;
+    d->bottom = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Frees the current array and every array it replaced. No other thread may use the deque any more.
+ */
+static inline void __EXPAND_CONCAT(DEQUE_NAME,_destroy)(DEQUE_NAME* d) {
+    __EXPAND_CONCAT(DEQUE_NAME,_array)* a = d->array;
+
+    while (a) {
+        __EXPAND_CONCAT(DEQUE_NAME,_array)* previous = a->previous;
+        __EXPAND_CONCAT(DEQUE_NAME,_array_destroy)(a);
+        a = previous;
+    }
+
+    d->array = NULL;
+}
+
+static inline int64_t __EXPAND_CONCAT(DEQUE_NAME,_size)(DEQUE_NAME* d) {
+    // Only exact while no other thread is stealing. Briefly -1 while the owner pops from an empty deque.
+    const int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    const int64_t top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    return bottom > top ? bottom - top : 0;
+}
+
+/**
+ * @brief Pushes a value at the bottom. Owner thread only.
+ * @return 0 on success, or -3 if a larger array could not be allocated.
+ */
+static inline int __EXPAND_CONCAT(DEQUE_NAME,_push)(DEQUE_NAME* d, DEQUE_TYPE value) {
+    const int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    const int64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __EXPAND_CONCAT(DEQUE_NAME,_array)* a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+    // If the array is full, copy the elements to an array of twice the capacity
+    if (bottom - top > a->capacity_mask) {
+        __EXPAND_CONCAT(DEQUE_NAME,_array)* new_array = __EXPAND_CONCAT(DEQUE_NAME,_array_create)(2 * (a->capacity_mask + 1));
+
+        if (!new_array)
+            return -3;
+
+        // Elements keep their indices, so thieves may keep using either array
+        for (int64_t i = top; i < bottom; i++)
+            __EXPAND_CONCAT(DEQUE_NAME,_array_set)(new_array, i, __EXPAND_CONCAT(DEQUE_NAME,_array_get)(a, i));
+
+        new_array->previous = a;
+
+        // Publish the copied elements along with the array
+        __atomic_store_n(&d->array, new_array, __ATOMIC_RELEASE);
+        a = new_array;
+    }
+
+    __EXPAND_CONCAT(DEQUE_NAME,_array_set)(a, bottom, value);
+
+    // Publish the value before the new bottom
+    __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * @brief Pops the most recently pushed value from the bottom. Owner thread only.
+ * @return 0 on success, or -1 if the deque is empty or a thief took the last element.
+ */
+static inline int __EXPAND_CONCAT(DEQUE_NAME,_pop)(DEQUE_NAME* d, DEQUE_TYPE* dst) {
+    const int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __EXPAND_CONCAT(DEQUE_NAME,_array)* a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+    // Claim the bottom element before looking at `top`. Thieves that read `top` after this
+    // see the smaller bottom, so at most one of them can be racing for the same element.
+    __atomic_store_n(&d->bottom, bottom, __ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+
+    if (top > bottom) {
+        // The deque was empty
+        __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    DEQUE_TYPE value = __EXPAND_CONCAT(DEQUE_NAME,_array_get)(a, bottom);
+
+    if (top == bottom) {
+        // The last element, which a thief may be taking as well. Whoever moves `top` first gets it.
+        const bool won = __atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+
+        // Either way, the deque is now empty
+        __atomic_store_n(&d->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+        if (!won)
+            return -1;
+    }
+
+    *dst = value;
+
+    return 0;
+}
+
+/**
+ * @brief Steals the least recently pushed value from the top. Safe to call from any thread.
+ * @return 0 on success, -1 if the deque is empty,
+ *         or -4 if another thread took the value first, in which case the deque may not be empty.
+ */
+static inline int __EXPAND_CONCAT(DEQUE_NAME,_steal)(DEQUE_NAME* d, DEQUE_TYPE* dst) {
+    int64_t top = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    const int64_t bottom = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+
+    if (top >= bottom)
+        return -1;
+
+    // Read the value before claiming it. Once `top` moves on, the owner may overwrite the slot.
+    __EXPAND_CONCAT(DEQUE_NAME,_array)* a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+    DEQUE_TYPE value = __EXPAND_CONCAT(DEQUE_NAME,_array_get)(a, top);
+
+    if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return -4;
+
+    *dst = value;
+
+    return 0;
+}
@@ -28,9 +28,22 @@
 #define STACK_TYPE HEAP_INDEX
 #define STACK_EXT_THREAD_SAFE
 
+// `_build` keeps a stack of the nodes left to visit, which only allocates for large arrays.
+// An inline capacity that the includer picked for their own stacks is left alone.
+#ifndef STACK_INLINE_CAPACITY
+#define STACK_INLINE_CAPACITY 64
+#define __HEAP_STACK_INLINE_CAPACITY
+#endif
+
 #include <stdlib.h>
+#include "ctools/alloc.h"
 #include "ctools/stack.h"
 
+#ifdef __HEAP_STACK_INLINE_CAPACITY
+#undef STACK_INLINE_CAPACITY
+#undef __HEAP_STACK_INLINE_CAPACITY
+#endif
+
 
 
 typedef struct HEAP_NAME {
@@ -54,7 +67,7 @@ static inline HEAP_TYPE __EXPAND_CONCAT(HEAP_NAME,_peek)(HEAP_NAME* h) {
  */
 static inline HEAP_NAME* __EXPAND_CONCAT(HEAP_NAME,_create)(const HEAP_INDEX initial_capacity) {
     // Allocate a new heap struct
-    HEAP_NAME* h = (HEAP_NAME*) malloc(sizeof(HEAP_NAME));
+    HEAP_NAME* h = (HEAP_NAME*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(HEAP_NAME));
 
     if (!h)
         return NULL;
@@ -67,10 +80,10 @@ static inline HEAP_NAME* __EXPAND_CONCAT(HEAP_NAME,_create)(const HEAP_INDEX ini
     h->capacity = starting_capacity;
     
     // Allocate the array containing the heap nodes
-    h->array = (HEAP_TYPE*) malloc(sizeof(HEAP_TYPE) * starting_capacity);
+    h->array = (HEAP_TYPE*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(HEAP_TYPE) * starting_capacity);
 
     if (!h->array) {
-        free(h);
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, h, sizeof(HEAP_NAME));
         return NULL;
     }
 
@@ -83,14 +96,14 @@ static inline HEAP_NAME* __EXPAND_CONCAT(HEAP_NAME,_create)(const HEAP_INDEX ini
  * @param h A pointer to a heap allocated by the _create() function.
  */
 static inline void __EXPAND_CONCAT(HEAP_NAME,_destroy)(HEAP_NAME* h) {
-    free(h->array);
-    free(h);
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, h->array, h->capacity * sizeof(HEAP_TYPE));
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, h, sizeof(HEAP_NAME));
 }
 
 static inline int __EXPAND_CONCAT(HEAP_NAME,_push)(HEAP_NAME* h, HEAP_TYPE value) {
     // If the storage array is full, double the capacity of the storage array
     if (h->size == h->capacity) {
-        HEAP_TYPE* new_array = (HEAP_TYPE*) realloc(h->array, 2 * h->capacity * sizeof(HEAP_TYPE));
+        HEAP_TYPE* new_array = (HEAP_TYPE*) CTOOLS_REALLOC(CTOOLS_ALLOC_CTX, h->array, h->capacity * sizeof(HEAP_TYPE), 2 * h->capacity * sizeof(HEAP_TYPE));
         
         // If we failed to allocate more memory, return an error
         if (!new_array) {
@@ -139,7 +152,7 @@ static inline int __EXPAND_CONCAT(HEAP_NAME,_pop)(HEAP_NAME* h, HEAP_TYPE* dst)
 
     // Decrease capacity if the heap size is a quarter of the capacity
     if ((h->size <= h->capacity / 4) && (h->capacity / 2 >= STACK_MIN_CAPACITY)) {
-        HEAP_TYPE* new_array = (HEAP_TYPE*) realloc(h->array, (h->capacity / 2) * sizeof(HEAP_TYPE));
+        HEAP_TYPE* new_array = (HEAP_TYPE*) CTOOLS_REALLOC(CTOOLS_ALLOC_CTX, h->array, h->capacity * sizeof(HEAP_TYPE), (h->capacity / 2) * sizeof(HEAP_TYPE));
         
         // If we failed to allocate more memory, return an error
         if (!new_array) {
@@ -232,6 +245,8 @@ static inline void __EXPAND_CONCAT(HEAP_NAME,_build)(HEAP_TYPE* heap_array, cons
             __EXPAND_CONCAT(STACK_NAME,_push)(&nodes, right_child);
         }
     }
+
+    __EXPAND_CONCAT(STACK_NAME,_destroy)(&nodes);
 }
 
 static inline HEAP_INDEX __EXPAND_CONCAT(HEAP_NAME,_verify)(const HEAP_TYPE* heap_array, const HEAP_INDEX heap_array_size) {
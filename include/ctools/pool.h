@@ -0,0 +1,92 @@
+#ifndef CTOOLS_POOL
+#define CTOOLS_POOL
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*ct_pool_fn)(void* arg);
+
+/**
+ * A fixed set of worker threads that run submitted tasks.
+ *
+ * Every worker owns a work-stealing deque (see deque.h). A task submitted from inside another task
+ * goes to the deque of the worker running it, without taking any lock, and is picked up by that worker next.
+ * Tasks submitted from any other thread go to a shared injection queue. A worker that runs out of work
+ * takes from the injection queue, then steals the oldest task of another worker, and goes to sleep
+ * when there is nothing to steal either.
+ *
+ * Delayed tasks wait in a heap ordered by their deadline (see heap.h), and are moved to the injection queue
+ * by whichever worker notices that they are due. Sleeping workers wake up in time for the earliest deadline.
+ *
+ * Like the `_shutdown` of the thread-safe containers, ct_pool_shutdown() makes every further submission fail.
+ * The workers then run every task that is already queued, including the delayed tasks that are due by then,
+ * drop the delayed tasks that are not due yet, and exit.
+ */
+struct ct_pool {
+    struct ct_pool_worker* workers;
+    unsigned int worker_count;
+
+    // The allocation that `workers` are aligned within
+    void* worker_block;
+
+    // Protects the injection queue and the timers, and is held by workers going to sleep
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    struct ct_pool_queue* injected;
+    struct ct_pool_timers* timers;
+
+    // The deadline of the earliest delayed task, or UINT64_MAX
+    uint64_t next_deadline;
+
+    // The number of workers that are asleep, or about to be
+    unsigned int sleeping;
+
+    // The number of tasks that have been submitted and not finished yet, delayed tasks included
+    uint64_t pending;
+
+    bool shutting_down;
+};
+
+/**
+ * @brief Starts a pool of @p worker_count threads.
+ * @param worker_count The number of worker threads, or 0 for one per online CPU.
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_pool_init(struct ct_pool* pool, unsigned int worker_count);
+
+/**
+ * @brief Shuts the pool down if that has not happened yet, waits for the workers to exit, and frees the pool.
+ *
+ * Delayed tasks that were not due yet at shutdown are dropped without running.
+ */
+void ct_pool_exit(struct ct_pool* pool);
+
+/**
+ * @brief Queues `fn(arg)` to run on one of the workers. Safe to call from any thread, including from tasks.
+ * @return 0 on success, or -1 on error with errno set.
+ *         Fails with ECANCELED once the pool is shutting down, and with ENOMEM if the task could not be queued.
+ */
+int ct_pool_submit(struct ct_pool* pool, ct_pool_fn fn, void* arg);
+
+/**
+ * @brief Queues `fn(arg)` to run on one of the workers once @p delay_ms milliseconds have passed.
+ * @return 0 on success, or -1 on error with errno set, like ct_pool_submit().
+ */
+int ct_pool_submit_delayed(struct ct_pool* pool, ct_pool_fn fn, void* arg, const unsigned int delay_ms);
+
+/**
+ * @brief Stops accepting tasks. Returns immediately, while the workers finish the queued tasks.
+ *
+ * Delayed tasks whose deadline has passed are queued to run as well. Those that are not due yet are dropped
+ * by ct_pool_exit() without running, and so are due tasks that could not be queued for lack of memory.
+ */
+void ct_pool_shutdown(struct ct_pool* pool);
+
+/**
+ * @brief The number of tasks that have been submitted and have not finished yet, delayed tasks included.
+ */
+uint64_t ct_pool_pending(struct ct_pool* pool);
+
+#endif // CTOOLS_POOL
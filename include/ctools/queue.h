@@ -11,20 +11,274 @@
 #define QUEUE_INDEX unsigned int
 #endif
 
+#if defined(QUEUE_EXT_SPSC) && defined(QUEUE_EXT_GROWABLE)
+#error "QUEUE_EXT_SPSC and QUEUE_EXT_GROWABLE cannot be combined"
+#endif
+
+#if defined(QUEUE_EXT_MPMC) && (defined(QUEUE_EXT_SPSC) || defined(QUEUE_EXT_GROWABLE))
+#error "QUEUE_EXT_MPMC cannot be combined with QUEUE_EXT_SPSC or QUEUE_EXT_GROWABLE"
+#endif
+
+#if defined(QUEUE_EXT_BLOCKING) && (defined(QUEUE_EXT_SPSC) || defined(QUEUE_EXT_MPMC))
+#error "QUEUE_EXT_BLOCKING cannot be combined with QUEUE_EXT_SPSC or QUEUE_EXT_MPMC"
+#endif
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
+#ifdef QUEUE_EXT_BLOCKING
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "ctools/alloc.h"
 #include "ctools/define_concat.h"
 
+// With QUEUE_EXT_SPSC, one producer thread may push while one consumer thread pops, without any locks.
+// The consumer owns `front` and the producer owns `back`, and each publishes its index to the other side
+// with a release store. Each side also keeps the last index it read from the other side, and only reads
+// the shared index again when that copy says the queue is full or empty, so the cache line holding
+// the other side's index does not bounce between the two cores on every call.
+
+#define __QUEUE_CACHE_LINE 64
+
+#ifdef QUEUE_EXT_SPSC
+#define __QUEUE_LOAD(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#else
+#define __QUEUE_LOAD(index) (index)
+#endif
+
+// With QUEUE_EXT_BLOCKING, any number of threads may push and pop, under a mutex. `_push_wait` and `_pop_wait`
+// sleep on a condition variable until there is room or an element, and `_shutdown` wakes them all up for good.
+//
+// The queue also owns an eventfd, returned by `_fd`, which is readable exactly while the queue holds elements,
+// or once it is shut down. A thread can wait for it in `epoll_wait` together with its sockets, and then `_pop`
+// until the queue is empty. The eventfd is only written when the queue stops being empty, and only read when
+// it becomes empty again, so a busy queue does not make any system calls.
+
+#ifdef QUEUE_EXT_BLOCKING
+#define __QUEUE_LOCK(q) pthread_mutex_lock(&(q)->lock)
+#define __QUEUE_UNLOCK(q) pthread_mutex_unlock(&(q)->lock)
+#else
+#define __QUEUE_LOCK(q)
+#define __QUEUE_UNLOCK(q)
+#endif
+
+static const QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_max_size) = (QUEUE_INDEX)1 << (sizeof(QUEUE_INDEX) * 8 - 1 - !(((QUEUE_INDEX)-1) > 0));
+
+
+
+#ifdef QUEUE_EXT_MPMC
+
+// With QUEUE_EXT_MPMC, any number of threads may push and pop at the same time (Vyukov's bounded queue).
+//
+// Every slot carries a sequence number, which tells whose turn it is. Slot i starts out at i, meaning it is free
+// for the push with ticket i. That push sets it to i + 1, meaning it is ready for the pop with ticket i, and that pop
+// sets it to i + capacity, the ticket of the next push to use the slot. Producers take tickets by advancing `back`
+// with a compare-and-swap, and consumers by advancing `front`, so each operation needs only one compare-and-swap,
+// on the counter of its own side. The tickets are free running `size_t` counters, and all slots are used.
+
+typedef struct __EXPAND_CONCAT(QUEUE_NAME,_slot) {
+    size_t sequence;
+    QUEUE_TYPE value;
+} __EXPAND_CONCAT(QUEUE_NAME,_slot);
+
+typedef struct QUEUE_NAME {
+    __EXPAND_CONCAT(QUEUE_NAME,_slot)* array;
+    QUEUE_INDEX capacity_mask;
+
+    // The two counters are kept a cache line apart by padding, since the allocator does not align the struct
+    char front_padding[__QUEUE_CACHE_LINE];
+    size_t front;
+
+    char back_padding[__QUEUE_CACHE_LINE];
+    size_t back;
+
+    char end_padding[__QUEUE_CACHE_LINE];
+} QUEUE_NAME;
+
+static QUEUE_NAME* __EXPAND_CONCAT(QUEUE_NAME,_create)(QUEUE_INDEX minimum_capacity) {
+    // Skip if the requested size is not supported, given the QUEUE_INDEX type
+    if (minimum_capacity > __EXPAND_CONCAT(QUEUE_NAME,_max_size) - 1)
+        return NULL;
+
+    QUEUE_NAME* q = (QUEUE_NAME*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(QUEUE_NAME));
+    if (!q)
+        return NULL;
+
+    // Round up to a power of two, which is at least as large as the single-threaded queue would be.
+    // A single slot would already be free for the next push after the first one, so there are at least two.
+    QUEUE_INDEX capacity = 2;
+    while (capacity < minimum_capacity + 1)
+        capacity <<= 1;
+
+    q->array = (__EXPAND_CONCAT(QUEUE_NAME,_slot)*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, capacity * sizeof(__EXPAND_CONCAT(QUEUE_NAME,_slot)));
+    if (!q->array) {
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, q, sizeof(QUEUE_NAME));
+        return NULL;
+    }
+
+    // Every slot is free for the first push that maps to it
+    for (size_t i = 0; i < capacity; i++)
+        q->array[i].sequence = i;
+
+    q->capacity_mask = capacity - 1;
+    q->front = 0;
+    q->back = 0;
+
+    return q;
+}
+
+static inline void __EXPAND_CONCAT(QUEUE_NAME,_destroy)(QUEUE_NAME* q) {
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, q->array, (q->capacity_mask + 1) * sizeof(__EXPAND_CONCAT(QUEUE_NAME,_slot)));
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, q, sizeof(QUEUE_NAME));
+}
+
+// `_size`, `_is_full` and `_is_empty` may be out of date by the time they return
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_size)(QUEUE_NAME* q) {
+    const size_t front = __atomic_load_n(&q->front, __ATOMIC_ACQUIRE);
+    const size_t back = __atomic_load_n(&q->back, __ATOMIC_ACQUIRE);
+
+    // A consumer may have taken a ticket for an element whose producer is still in the middle of pushing it
+    const size_t size = (intptr_t) (back - front) > 0 ? back - front : 0;
+    return size > (size_t) q->capacity_mask + 1 ? q->capacity_mask + 1 : size;
+}
+
+// Unlike the single-threaded queue, every slot of the array can be used
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_capacity)(QUEUE_NAME* q) {
+    return q->capacity_mask + 1;
+}
+
+static inline bool __EXPAND_CONCAT(QUEUE_NAME,_is_full)(QUEUE_NAME* q) {
+    return __EXPAND_CONCAT(QUEUE_NAME,_size)(q) == (size_t) q->capacity_mask + 1;
+}
+
+static inline bool __EXPAND_CONCAT(QUEUE_NAME,_is_empty)(QUEUE_NAME* q) {
+    return __EXPAND_CONCAT(QUEUE_NAME,_size)(q) == 0;
+}
+
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_push)(QUEUE_NAME* q, QUEUE_TYPE value) {
+    __EXPAND_CONCAT(QUEUE_NAME,_slot)* slot;
+    size_t back = __atomic_load_n(&q->back, __ATOMIC_RELAXED);
+
+    while (1) {
+        slot = &q->array[back & q->capacity_mask];
+
+        const size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        const intptr_t difference = (intptr_t) (sequence - back);
+
+        if (difference == 0) {
+            // The slot is free, so try to take the ticket. On failure, `back` is reloaded.
+            if (__atomic_compare_exchange_n(&q->back, &back, back + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (difference < 0) {
+            // The slot still holds the element from one lap ago, so the queue is full
+            return -1;
+        } else {
+            // Another producer took the ticket
+            back = __atomic_load_n(&q->back, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->value = value;
+
+    // Hand the slot to the consumer with the same ticket
+    __atomic_store_n(&slot->sequence, back + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop)(QUEUE_NAME* q, QUEUE_TYPE* dst) {
+    __EXPAND_CONCAT(QUEUE_NAME,_slot)* slot;
+    size_t front = __atomic_load_n(&q->front, __ATOMIC_RELAXED);
+
+    while (1) {
+        slot = &q->array[front & q->capacity_mask];
+
+        const size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        const intptr_t difference = (intptr_t) (sequence - (front + 1));
+
+        if (difference == 0) {
+            // The slot is filled, so try to take the ticket. On failure, `front` is reloaded.
+            if (__atomic_compare_exchange_n(&q->front, &front, front + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (difference < 0) {
+            // The producer with this ticket has not pushed yet, so the queue is empty
+            return -1;
+        } else {
+            // Another consumer took the ticket
+            front = __atomic_load_n(&q->front, __ATOMIC_RELAXED);
+        }
+    }
+
+    *dst = slot->value;
+
+    // Hand the slot to the producer one lap ahead
+    __atomic_store_n(&slot->sequence, front + q->capacity_mask + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+// Every element goes through its own slot handshake, so the batches are only a convenience in this mode
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_push_n)(QUEUE_NAME* q, const QUEUE_TYPE* src, const QUEUE_INDEX count) {
+    QUEUE_INDEX pushed = 0;
+
+    while (pushed < count && !__EXPAND_CONCAT(QUEUE_NAME,_push)(q, src[pushed]))
+        pushed++;
+
+    return pushed;
+}
+
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_pop_n)(QUEUE_NAME* q, QUEUE_TYPE* dst, const QUEUE_INDEX max) {
+    QUEUE_INDEX popped = 0;
+
+    while (popped < max && !__EXPAND_CONCAT(QUEUE_NAME,_pop)(q, &dst[popped]))
+        popped++;
+
+    return popped;
+}
+
+#else
+
 typedef struct QUEUE_NAME {
     QUEUE_TYPE* array;
     QUEUE_INDEX capacity_mask;
 
+    #ifdef QUEUE_EXT_SPSC
+
+    // The two sides are kept a cache line apart by padding, since the allocator does not align the struct
+    char front_padding[__QUEUE_CACHE_LINE];
+
+    // Consumer side
     QUEUE_INDEX front;
+    QUEUE_INDEX cached_back;
+
+    char back_padding[__QUEUE_CACHE_LINE];
+
+    // Producer side
     QUEUE_INDEX back;
-} QUEUE_NAME;
+    QUEUE_INDEX cached_front;
 
-static const QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_max_size) = (QUEUE_INDEX)1 << (sizeof(QUEUE_INDEX) * 8 - 1 - !(((QUEUE_INDEX)-1) > 0));
+    char end_padding[__QUEUE_CACHE_LINE];
+
+    #else
+    QUEUE_INDEX front;
+    QUEUE_INDEX back;
+    #endif
+
+    #ifdef QUEUE_EXT_BLOCKING
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int event_fd;
+    bool shutting_down;
+    #endif
+} QUEUE_NAME;
 
 static QUEUE_NAME* __EXPAND_CONCAT(QUEUE_NAME,_create)(QUEUE_INDEX minimum_capacity) {
     // Skip if the requested size is not supported, given the QUEUE_INDEX type
@@ -35,7 +289,7 @@ static QUEUE_NAME* __EXPAND_CONCAT(QUEUE_NAME,_create)(QUEUE_INDEX minimum_capac
     minimum_capacity += 1;
 
     // The actual queue object to allocate and initilize
-    QUEUE_NAME* q = (QUEUE_NAME*) malloc(sizeof(QUEUE_NAME));
+    QUEUE_NAME* q = (QUEUE_NAME*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(QUEUE_NAME));
     if (!q)
         return NULL;
 
@@ -49,9 +303,9 @@ static QUEUE_NAME* __EXPAND_CONCAT(QUEUE_NAME,_create)(QUEUE_INDEX minimum_capac
         capacity <<= 1;
     
     // Allocate the container array
-    q->array = (QUEUE_TYPE*) malloc(capacity * sizeof(QUEUE_TYPE));
+    q->array = (QUEUE_TYPE*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, capacity * sizeof(QUEUE_TYPE));
     if (!q->array) {
-        free(q);
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, q, sizeof(QUEUE_NAME));
         return NULL;
     }
 
@@ -60,41 +314,217 @@ static QUEUE_NAME* __EXPAND_CONCAT(QUEUE_NAME,_create)(QUEUE_INDEX minimum_capac
     q->back = 0;
     q->front = 0;
 
+    #ifdef QUEUE_EXT_SPSC
+    q->cached_back = 0;
+    q->cached_front = 0;
+    #endif
+
+    #ifdef QUEUE_EXT_BLOCKING
+    q->shutting_down = false;
+
+    // Let `_push_wait` and `_pop_wait` measure their timeouts on a clock that does not jump
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+    const int cond_res = pthread_cond_init(&q->not_empty, &cond_attr);
+    const int other_cond_res = cond_res ? 0 : pthread_cond_init(&q->not_full, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (cond_res || other_cond_res || pthread_mutex_init(&q->lock, NULL)) {
+        if (!cond_res)
+            pthread_cond_destroy(&q->not_empty);
+        if (!cond_res && !other_cond_res)
+            pthread_cond_destroy(&q->not_full);
+
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, q->array, capacity * sizeof(QUEUE_TYPE));
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, q, sizeof(QUEUE_NAME));
+        return NULL;
+    }
+
+    // Non-blocking, so draining it never waits
+    q->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->event_fd < 0) {
+        pthread_mutex_destroy(&q->lock);
+        pthread_cond_destroy(&q->not_full);
+        pthread_cond_destroy(&q->not_empty);
+
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, q->array, capacity * sizeof(QUEUE_TYPE));
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, q, sizeof(QUEUE_NAME));
+        return NULL;
+    }
+    #endif
+
     return q;
 }
 
+// With QUEUE_EXT_BLOCKING, no other thread may use the queue any more, nor wait on its eventfd
 static inline void __EXPAND_CONCAT(QUEUE_NAME,_destroy)(QUEUE_NAME* q) {
-    free(q->array);
-    free(q);
+    #ifdef QUEUE_EXT_BLOCKING
+    close(q->event_fd);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    #endif
+
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, q->array, (q->capacity_mask + 1) * sizeof(QUEUE_TYPE));
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, q, sizeof(QUEUE_NAME));
 }
 
 static inline void __EXPAND_CONCAT(QUEUE_NAME,_peek)(QUEUE_NAME* q, QUEUE_TYPE* dst) {
+    // Consumer thread only, with QUEUE_EXT_SPSC. Loading `back` makes the element visible.
+    __QUEUE_LOCK(q);
+    (void) __QUEUE_LOAD(q->back);
     *dst = q->array[q->front];
+    __QUEUE_UNLOCK(q);
 }
 
+// With QUEUE_EXT_SPSC or QUEUE_EXT_BLOCKING, `_size`, `_is_full` and `_is_empty` may be out of date by the time they return
 static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_size)(QUEUE_NAME* q) {
-    QUEUE_INDEX back = q->back + (q->capacity_mask + 1) * (q->back < q->front);
-    return back - q->front;
+    __QUEUE_LOCK(q);
+    const QUEUE_INDEX front = __QUEUE_LOAD(q->front);
+    QUEUE_INDEX back = __QUEUE_LOAD(q->back);
+    const QUEUE_INDEX length = q->capacity_mask + 1;
+    __QUEUE_UNLOCK(q);
+
+    back += length * (back < front);
+    return back - front;
 }
 
-static inline bool __EXPAND_CONCAT(QUEUE_NAME,_capacity)(QUEUE_NAME* q) {
-    return q->capacity_mask + 1;
+// The number of elements that fit, which is one less than the length of the array
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_capacity)(QUEUE_NAME* q) {
+    __QUEUE_LOCK(q);
+    const QUEUE_INDEX capacity = q->capacity_mask;
+    __QUEUE_UNLOCK(q);
+
+    return capacity;
 }
 
 static inline bool __EXPAND_CONCAT(QUEUE_NAME,_is_full)(QUEUE_NAME* q) {
-    return q->front == ((q->back + 1) & q->capacity_mask);
+    __QUEUE_LOCK(q);
+    const bool full = __QUEUE_LOAD(q->front) == ((__QUEUE_LOAD(q->back) + 1) & q->capacity_mask);
+    __QUEUE_UNLOCK(q);
+
+    return full;
 }
 
 static inline bool __EXPAND_CONCAT(QUEUE_NAME,_is_empty)(QUEUE_NAME* q) {
-    return q->front == q->back;
+    __QUEUE_LOCK(q);
+    const bool empty = __QUEUE_LOAD(q->front) == __QUEUE_LOAD(q->back);
+    __QUEUE_UNLOCK(q);
+
+    return empty;
+}
+
+#ifdef QUEUE_EXT_BLOCKING
+// Makes the eventfd readable, after `pushed` elements went into a queue that may have been empty. The caller holds the lock.
+static inline void __EXPAND_CONCAT(QUEUE_NAME,_fd_pushed)(QUEUE_NAME* q, const QUEUE_INDEX pushed) {
+    if (pushed && ((q->back - q->front) & q->capacity_mask) == pushed) {
+        const uint64_t one = 1;
+        (void) !write(q->event_fd, &one, sizeof(one));
+    }
+}
+
+// Drains the eventfd, after a pop that may have emptied the queue. The caller holds the lock.
+static inline void __EXPAND_CONCAT(QUEUE_NAME,_fd_popped)(QUEUE_NAME* q, const QUEUE_INDEX popped) {
+    if (popped && q->front == q->back) {
+        uint64_t count;
+        (void) !read(q->event_fd, &count, sizeof(count));
+    }
 }
+#endif
+
 
 
+#ifdef QUEUE_EXT_GROWABLE
+// Doubles the length of the array.
+// Returns -1 if the length cannot be represented by QUEUE_INDEX, or -3 on allocation failure.
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_grow)(QUEUE_NAME* q) {
+    const QUEUE_INDEX length = q->capacity_mask + 1;
+    if (length >= __EXPAND_CONCAT(QUEUE_NAME,_max_size))
+        return -1;
+
+    QUEUE_TYPE* array = (QUEUE_TYPE*) CTOOLS_REALLOC(CTOOLS_ALLOC_CTX, q->array, length * sizeof(QUEUE_TYPE), 2 * length * sizeof(QUEUE_TYPE));
+    if (!array)
+        return -3;
 
+    // If the elements wrap around the end of the old array, they are split into a run from `front` to the end,
+    // and a run from the start to `back`. Moving either run by `length` makes them contiguous in the doubled ring,
+    // so only the shorter one is copied.
+    if (q->back < q->front) {
+        if (q->back <= length - q->front) {
+            memcpy(&array[length], array, q->back * sizeof(QUEUE_TYPE));
+            q->back += length;
+        } else {
+            memcpy(&array[q->front + length], &array[q->front], (length - q->front) * sizeof(QUEUE_TYPE));
+            q->front += length;
+        }
+    }
+
+    q->array = array;
+    q->capacity_mask = 2 * length - 1;
+
+    return 0;
+}
+#endif
+
+#ifdef QUEUE_EXT_SPSC
+
+// Producer thread only
 static inline int __EXPAND_CONCAT(QUEUE_NAME,_push)(QUEUE_NAME* q, QUEUE_TYPE value) {
-    // Skip if queue is full
-    if (q->front == ((q->back + 1) & q->capacity_mask))
+    const QUEUE_INDEX back = q->back;
+    const QUEUE_INDEX next = (back + 1) & q->capacity_mask;
+
+    // Skip if queue is full. Only look at the consumer's index if the cached copy says so.
+    if (next == q->cached_front) {
+        q->cached_front = __atomic_load_n(&q->front, __ATOMIC_ACQUIRE);
+
+        if (next == q->cached_front)
+            return -1;
+    }
+
+    q->array[back] = value;
+
+    // Publish the element along with the index
+    __atomic_store_n(&q->back, next, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+// Consumer thread only
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop)(QUEUE_NAME* q, QUEUE_TYPE* dst) {
+    const QUEUE_INDEX front = q->front;
+
+    // Skip if queue is empty. Only look at the producer's index if the cached copy says so.
+    if (front == q->cached_back) {
+        q->cached_back = __atomic_load_n(&q->back, __ATOMIC_ACQUIRE);
+
+        if (front == q->cached_back)
+            return -1;
+    }
+
+    *dst = q->array[front];
+
+    // Hand the slot back to the producer, once the element has been read
+    __atomic_store_n(&q->front, (front + 1) & q->capacity_mask, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+#else
+
+// The caller holds the lock, if there is one
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_push_unlocked)(QUEUE_NAME* q, QUEUE_TYPE value) {
+    // Skip if queue is full, or double its capacity with QUEUE_EXT_GROWABLE
+    if (q->front == ((q->back + 1) & q->capacity_mask)) {
+        #ifdef QUEUE_EXT_GROWABLE
+        const int res = __EXPAND_CONCAT(QUEUE_NAME,_grow)(q);
+        if (res)
+            return res;
+        #else
         return -1;
+        #endif
+    }
 
     q->array[q->back] = value;
     q->back = (q->back + 1) & q->capacity_mask;
@@ -102,7 +532,8 @@ static inline int __EXPAND_CONCAT(QUEUE_NAME,_push)(QUEUE_NAME* q, QUEUE_TYPE va
     return 0;
 }
 
-static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop)(QUEUE_NAME* q, QUEUE_TYPE* dst) {
+// The caller holds the lock, if there is one
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop_unlocked)(QUEUE_NAME* q, QUEUE_TYPE* dst) {
     // Skip if queue is empty
     if (q->front == q->back)
         return -1;
@@ -112,3 +543,330 @@ static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop)(QUEUE_NAME* q, QUEUE_TYPE* ds
 
     return 0;
 }
+
+// With QUEUE_EXT_BLOCKING, returns -2 if the queue is shutting down
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_push)(QUEUE_NAME* q, QUEUE_TYPE value) {
+    #ifdef QUEUE_EXT_BLOCKING
+    pthread_mutex_lock(&q->lock);
+
+    // Cancel if the queue is shutting down
+    if (q->shutting_down) {
+        pthread_mutex_unlock(&q->lock);
+        return -2;
+    }
+    #endif
+
+    const int res = __EXPAND_CONCAT(QUEUE_NAME,_push_unlocked)(q, value);
+
+    // Unlock, and wake up one thread blocked in `_pop_wait`, if any
+    #ifdef QUEUE_EXT_BLOCKING
+    __EXPAND_CONCAT(QUEUE_NAME,_fd_pushed)(q, !res);
+    pthread_mutex_unlock(&q->lock);
+
+    if (!res)
+        pthread_cond_signal(&q->not_empty);
+    #endif
+
+    return res;
+}
+
+// With QUEUE_EXT_BLOCKING, returns -2 if the queue is shutting down
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop)(QUEUE_NAME* q, QUEUE_TYPE* dst) {
+    #ifdef QUEUE_EXT_BLOCKING
+    pthread_mutex_lock(&q->lock);
+
+    // If the queue is shutting down, skip
+    if (q->shutting_down) {
+        pthread_mutex_unlock(&q->lock);
+        return -2;
+    }
+    #endif
+
+    const int res = __EXPAND_CONCAT(QUEUE_NAME,_pop_unlocked)(q, dst);
+
+    // Unlock, and wake up one thread blocked in `_push_wait`, if any
+    #ifdef QUEUE_EXT_BLOCKING
+    __EXPAND_CONCAT(QUEUE_NAME,_fd_popped)(q, !res);
+    pthread_mutex_unlock(&q->lock);
+
+    if (!res)
+        pthread_cond_signal(&q->not_full);
+    #endif
+
+    return res;
+}
+
+#endif // QUEUE_EXT_SPSC
+
+// Copies `count` elements into the array, starting at `back`, in at most two runs around the end of the array
+static inline void __EXPAND_CONCAT(QUEUE_NAME,_copy_in)(QUEUE_NAME* q, const QUEUE_INDEX back, const QUEUE_TYPE* src, const QUEUE_INDEX count) {
+    const QUEUE_INDEX until_end = q->capacity_mask + 1 - back;
+    const QUEUE_INDEX first_run = count < until_end ? count : until_end;
+
+    memcpy(&q->array[back], src, first_run * sizeof(QUEUE_TYPE));
+    memcpy(q->array, &src[first_run], (count - first_run) * sizeof(QUEUE_TYPE));
+}
+
+// Copies `count` elements out of the array, starting at `front`, in at most two runs around the end of the array
+static inline void __EXPAND_CONCAT(QUEUE_NAME,_copy_out)(QUEUE_NAME* q, const QUEUE_INDEX front, QUEUE_TYPE* dst, const QUEUE_INDEX count) {
+    const QUEUE_INDEX until_end = q->capacity_mask + 1 - front;
+    const QUEUE_INDEX first_run = count < until_end ? count : until_end;
+
+    memcpy(dst, &q->array[front], first_run * sizeof(QUEUE_TYPE));
+    memcpy(&dst[first_run], q->array, (count - first_run) * sizeof(QUEUE_TYPE));
+}
+
+/**
+ * @brief Pushes as many of the `count` elements in `src` as fit, in order.
+ *
+ * With QUEUE_EXT_GROWABLE, the queue grows to fit all of them, unless that fails. With QUEUE_EXT_SPSC, producer thread only.
+ * With QUEUE_EXT_BLOCKING, takes the lock once for the whole batch.
+ *
+ * @return The number of elements pushed, which is less than `count` if the queue ran full, and 0 if it is shutting down.
+ */
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_push_n)(QUEUE_NAME* q, const QUEUE_TYPE* src, QUEUE_INDEX count) {
+    #ifdef QUEUE_EXT_BLOCKING
+    pthread_mutex_lock(&q->lock);
+
+    // Cancel if the queue is shutting down
+    if (q->shutting_down) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    #endif
+
+    #ifdef QUEUE_EXT_SPSC
+    const QUEUE_INDEX back = q->back;
+
+    // Only look at the consumer's index if the cached copy does not leave enough room
+    QUEUE_INDEX free_slots = (q->cached_front - back - 1) & q->capacity_mask;
+    if (free_slots < count) {
+        q->cached_front = __atomic_load_n(&q->front, __ATOMIC_ACQUIRE);
+        free_slots = (q->cached_front - back - 1) & q->capacity_mask;
+    }
+    #else
+    QUEUE_INDEX free_slots = q->capacity_mask - ((q->back - q->front) & q->capacity_mask);
+
+    #ifdef QUEUE_EXT_GROWABLE
+    while (free_slots < count && !__EXPAND_CONCAT(QUEUE_NAME,_grow)(q))
+        free_slots = q->capacity_mask - ((q->back - q->front) & q->capacity_mask);
+    #endif
+    #endif
+
+    if (count > free_slots)
+        count = free_slots;
+
+    // Growing may have moved `back`
+    __EXPAND_CONCAT(QUEUE_NAME,_copy_in)(q, q->back, src, count);
+
+    #ifdef QUEUE_EXT_SPSC
+    // Publish the elements along with the index
+    __atomic_store_n(&q->back, (back + count) & q->capacity_mask, __ATOMIC_RELEASE);
+    #else
+    q->back = (q->back + count) & q->capacity_mask;
+    #endif
+
+    // Unlock, and wake up the threads blocked in `_pop_wait`, if any
+    #ifdef QUEUE_EXT_BLOCKING
+    __EXPAND_CONCAT(QUEUE_NAME,_fd_pushed)(q, count);
+    pthread_mutex_unlock(&q->lock);
+
+    if (count)
+        pthread_cond_broadcast(&q->not_empty);
+    #endif
+
+    return count;
+}
+
+/**
+ * @brief Pops up to `max` elements into `dst`, in order. With QUEUE_EXT_SPSC, consumer thread only.
+ * @return The number of elements popped, which is 0 if the queue is empty, or with QUEUE_EXT_BLOCKING, shutting down.
+ */
+static inline QUEUE_INDEX __EXPAND_CONCAT(QUEUE_NAME,_pop_n)(QUEUE_NAME* q, QUEUE_TYPE* dst, const QUEUE_INDEX max) {
+    #ifdef QUEUE_EXT_BLOCKING
+    pthread_mutex_lock(&q->lock);
+
+    // If the queue is shutting down, skip
+    if (q->shutting_down) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    #endif
+
+    const QUEUE_INDEX front = q->front;
+
+    #ifdef QUEUE_EXT_SPSC
+    // Only look at the producer's index if the cached copy does not hold enough elements
+    QUEUE_INDEX available = (q->cached_back - front) & q->capacity_mask;
+    if (available < max) {
+        q->cached_back = __atomic_load_n(&q->back, __ATOMIC_ACQUIRE);
+        available = (q->cached_back - front) & q->capacity_mask;
+    }
+    #else
+    const QUEUE_INDEX available = (q->back - front) & q->capacity_mask;
+    #endif
+
+    const QUEUE_INDEX count = max < available ? max : available;
+
+    __EXPAND_CONCAT(QUEUE_NAME,_copy_out)(q, front, dst, count);
+
+    #ifdef QUEUE_EXT_SPSC
+    // Hand the slots back to the producer, once the elements have been read
+    __atomic_store_n(&q->front, (front + count) & q->capacity_mask, __ATOMIC_RELEASE);
+    #else
+    q->front = (front + count) & q->capacity_mask;
+    #endif
+
+    // Unlock, and wake up the threads blocked in `_push_wait`, if any
+    #ifdef QUEUE_EXT_BLOCKING
+    __EXPAND_CONCAT(QUEUE_NAME,_fd_popped)(q, count);
+    pthread_mutex_unlock(&q->lock);
+
+    if (count)
+        pthread_cond_broadcast(&q->not_full);
+    #endif
+
+    return count;
+}
+
+#ifdef QUEUE_EXT_BLOCKING
+
+/**
+ * @brief The eventfd of the queue, which is readable while the queue holds elements, or once it is shut down.
+ *
+ * Only wait for it to become readable, e.g. with `epoll_wait`, and then pop. Reading it directly breaks the guarantee.
+ */
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_fd)(QUEUE_NAME* q) {
+    return q->event_fd;
+}
+
+/**
+ * @brief Makes every further push and pop fail with -2, and wakes up every thread waiting for the queue.
+ */
+static inline void __EXPAND_CONCAT(QUEUE_NAME,_shutdown)(QUEUE_NAME* q) {
+    pthread_mutex_lock(&q->lock);
+
+    // The eventfd is already readable if the queue holds elements
+    if (!q->shutting_down && q->front == q->back) {
+        const uint64_t one = 1;
+        (void) !write(q->event_fd, &one, sizeof(one));
+    }
+
+    q->shutting_down = true;
+
+    // Wake up every thread blocked in `_push_wait` or `_pop_wait`
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Waits on `cond` until `deadline`, or forever if `timeout_ms` is negative. Returns true once the time has run out.
+static inline bool __EXPAND_CONCAT(QUEUE_NAME,_wait)(QUEUE_NAME* q, pthread_cond_t* cond, const int timeout_ms, const struct timespec* deadline) {
+    if (timeout_ms == 0)
+        return true;
+
+    if (timeout_ms < 0) {
+        pthread_cond_wait(cond, &q->lock);
+        return false;
+    }
+
+    return pthread_cond_timedwait(cond, &q->lock, deadline) == ETIMEDOUT;
+}
+
+// The deadline `timeout_ms` from now, on the same clock as the condition variables
+static inline struct timespec __EXPAND_CONCAT(QUEUE_NAME,_deadline)(const int timeout_ms) {
+    struct timespec deadline = { 0, 0 };
+
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    return deadline;
+}
+
+/**
+ * @brief Pushes a value, waiting for room if the queue is full.
+ * @param timeout_ms The longest time to wait, or a negative value to wait forever. 0 does not wait.
+ * @return 0 on success, -1 if the queue was still full when the time ran out,
+ *         -2 if the queue is shutting down, or was shut down while waiting, or -3 on allocation failure.
+ */
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_push_wait)(QUEUE_NAME* q, QUEUE_TYPE value, const int timeout_ms) {
+    const struct timespec deadline = __EXPAND_CONCAT(QUEUE_NAME,_deadline)(timeout_ms);
+    int res = -2;
+
+    pthread_mutex_lock(&q->lock);
+
+    // Sleep until an element is popped, the queue shuts down, or the time runs out.
+    // Spurious wake-ups and other producers taking the slot first lead back here.
+    bool timed_out = false;
+    while (!q->shutting_down) {
+        res = __EXPAND_CONCAT(QUEUE_NAME,_push_unlocked)(q, value);
+        if (res != -1 || timed_out)
+            break;
+
+        timed_out = __EXPAND_CONCAT(QUEUE_NAME,_wait)(q, &q->not_full, timeout_ms, &deadline);
+    }
+
+    if (q->shutting_down)
+        res = -2;
+
+    __EXPAND_CONCAT(QUEUE_NAME,_fd_pushed)(q, !res);
+    pthread_mutex_unlock(&q->lock);
+
+    if (!res)
+        pthread_cond_signal(&q->not_empty);
+
+    return res;
+}
+
+/**
+ * @brief Pops the front element, waiting for one to be pushed if the queue is empty.
+ * @param timeout_ms The longest time to wait, or a negative value to wait forever. 0 does not wait.
+ * @return 0 on success, -1 if the queue was still empty when the time ran out,
+ *         or -2 if the queue is shutting down, or was shut down while waiting.
+ */
+static inline int __EXPAND_CONCAT(QUEUE_NAME,_pop_wait)(QUEUE_NAME* q, QUEUE_TYPE* dst, const int timeout_ms) {
+    const struct timespec deadline = __EXPAND_CONCAT(QUEUE_NAME,_deadline)(timeout_ms);
+
+    pthread_mutex_lock(&q->lock);
+
+    // Sleep until something is pushed, the queue shuts down, or the time runs out.
+    // Spurious wake-ups and other consumers taking the element first lead back here.
+    while (q->front == q->back && !q->shutting_down) {
+        if (__EXPAND_CONCAT(QUEUE_NAME,_wait)(q, &q->not_empty, timeout_ms, &deadline))
+            break;
+    }
+
+    // If the queue is shutting down, skip
+    if (q->shutting_down) {
+        pthread_mutex_unlock(&q->lock);
+        return -2;
+    }
+
+    const int res = __EXPAND_CONCAT(QUEUE_NAME,_pop_unlocked)(q, dst);
+
+    __EXPAND_CONCAT(QUEUE_NAME,_fd_popped)(q, !res);
+    pthread_mutex_unlock(&q->lock);
+
+    if (!res)
+        pthread_cond_signal(&q->not_full);
+
+    return res;
+}
+
+#endif // QUEUE_EXT_BLOCKING
+
+#endif // QUEUE_EXT_MPMC
+
+#undef __QUEUE_CACHE_LINE
+#undef __QUEUE_LOAD
+#undef __QUEUE_LOCK
+#undef __QUEUE_UNLOCK
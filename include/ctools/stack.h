@@ -12,14 +12,27 @@
 #define STACK_MIN_CAPACITY 8
 #endif
 
+#if defined(STACK_INLINE_CAPACITY) && (defined(STACK_CAPACITY) || defined(STACK_EXT_LOCK_FREE))
+#error "STACK_INLINE_CAPACITY cannot be combined with STACK_CAPACITY or STACK_EXT_LOCK_FREE"
+#endif
+
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
 
 #ifdef STACK_EXT_THREAD_SAFE
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#endif
+
+#ifdef STACK_EXT_LOCK_FREE
+#include <stdint.h>
 #endif
 
+#include "ctools/alloc.h"
 #include "ctools/define_concat.h"
 
 
@@ -30,10 +43,337 @@
 // STACK_INDEX __EXPAND_CONCAT(STACK_NAME,_size)(STACK_NAME* s);
 // int __EXPAND_CONCAT(STACK_NAME,_push)(STACK_NAME* s, STACK_TYPE value);
 // int __EXPAND_CONCAT(STACK_NAME,_pop)(STACK_NAME* s, STACK_TYPE* dst);
+// int __EXPAND_CONCAT(STACK_NAME,_push_n)(STACK_NAME* s, const STACK_TYPE* src, const STACK_INDEX count);
+// ssize_t __EXPAND_CONCAT(STACK_NAME,_pop_n)(STACK_NAME* s, STACK_TYPE* dst, const STACK_INDEX max);
+// int __EXPAND_CONCAT(STACK_NAME,_pop_wait)(STACK_NAME* s, STACK_TYPE* dst, const int timeout_ms); // STACK_EXT_THREAD_SAFE only
 // void __EXPAND_CONCAT(STACK_NAME,_shutdown)(STACK_NAME* s);
 // void __EXPAND_CONCAT(STACK_NAME,_destroy)(STACK_NAME* s);
 
+// With STACK_MAGAZINE_SIZE:
+// void __EXPAND_CONCAT(STACK_NAME,_magazine_init)(STACK_NAME_magazine* m, STACK_NAME* shared);
+// int __EXPAND_CONCAT(STACK_NAME,_magazine_push)(STACK_NAME_magazine* m, STACK_TYPE value);
+// int __EXPAND_CONCAT(STACK_NAME,_magazine_pop)(STACK_NAME_magazine* m, STACK_TYPE* dst);
+// int __EXPAND_CONCAT(STACK_NAME,_magazine_flush)(STACK_NAME_magazine* m);
+
+
+
+#ifdef STACK_EXT_LOCK_FREE
+
+#ifdef STACK_EXT_THREAD_SAFE
+#error "STACK_EXT_LOCK_FREE and STACK_EXT_THREAD_SAFE cannot be combined"
+#endif
+
+// The lock-free stack keeps its elements in a pool of nodes, linked by 32-bit indices.
+// The top of the stack and the top of the list of free nodes are each packed together with a tag
+// into 64 bits, and the tag is bumped by every compare-and-swap. A node that is popped and pushed again
+// between the load and the compare-and-swap of another thread (ABA) therefore fails that compare-and-swap.
+//
+// With STACK_CAPACITY, the nodes live inside the struct. Otherwise they are allocated in chunks of doubling size,
+// which are never moved or freed before `_destroy`, so a thread may still read a node that was popped under it.
 
+#define __STACK_NIL UINT32_MAX
+#define __STACK_PACK(index, tag) (((uint64_t) (tag) << 32) | (uint32_t) (index))
+#define __STACK_INDEX_OF(top) ((uint32_t) (top))
+#define __STACK_TAG_OF(top) ((uint32_t) ((top) >> 32))
+
+typedef struct __EXPAND_CONCAT(STACK_NAME,_node) {
+    STACK_TYPE value;
+    uint32_t next;
+} __EXPAND_CONCAT(STACK_NAME,_node);
+
+typedef struct STACK_NAME {
+    STACK_INDEX size;
+
+    // The top of the stack, and the top of the free nodes
+    uint64_t top;
+    uint64_t free;
+
+    #ifdef STACK_CAPACITY
+    __EXPAND_CONCAT(STACK_NAME,_node) nodes[STACK_CAPACITY];
+    #else
+    // Chunk k holds `1 << (chunk_shift + k)` nodes
+    __EXPAND_CONCAT(STACK_NAME,_node)* chunks[32];
+    uint32_t chunk_count;
+    uint32_t chunk_shift;
+    #endif
+
+    bool shutting_down;
+} STACK_NAME;
+
+static inline __EXPAND_CONCAT(STACK_NAME,_node)* __EXPAND_CONCAT(STACK_NAME,_node_at)(STACK_NAME* s, const uint32_t index) {
+    #ifdef STACK_CAPACITY
+    return &s->nodes[index];
+    #else
+    // Chunk k starts at index `((1 << k) - 1) << chunk_shift`.
+    // Its pointer is set with a compare-and-swap, which other threads may be attempting at the same time.
+    const unsigned int k = 31 - __builtin_clz((index >> s->chunk_shift) + 1);
+    __EXPAND_CONCAT(STACK_NAME,_node)* chunk = __atomic_load_n(&s->chunks[k], __ATOMIC_RELAXED);
+    return &chunk[index - (((1u << k) - 1) << s->chunk_shift)];
+    #endif
+}
+
+static inline void __EXPAND_CONCAT(STACK_NAME,_list_push)(STACK_NAME* s, uint64_t* list, const uint32_t first, const uint32_t last) {
+    __EXPAND_CONCAT(STACK_NAME,_node)* last_node = __EXPAND_CONCAT(STACK_NAME,_node_at)(s, last);
+    uint64_t top = __atomic_load_n(list, __ATOMIC_RELAXED);
+
+    // Release the nodes, along with the values written to them
+    do {
+        __atomic_store_n(&last_node->next, __STACK_INDEX_OF(top), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(list, &top, __STACK_PACK(first, __STACK_TAG_OF(top) + 1), 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static inline uint32_t __EXPAND_CONCAT(STACK_NAME,_list_pop)(STACK_NAME* s, uint64_t* list) {
+    uint64_t top = __atomic_load_n(list, __ATOMIC_ACQUIRE);
+    uint64_t next;
+
+    do {
+        if (__STACK_INDEX_OF(top) == __STACK_NIL)
+            return __STACK_NIL;
+
+        // The node may be popped and reused by another thread meanwhile, in which case the tag has moved on
+        const uint32_t next_index = __atomic_load_n(&__EXPAND_CONCAT(STACK_NAME,_node_at)(s, __STACK_INDEX_OF(top))->next, __ATOMIC_RELAXED);
+        next = __STACK_PACK(next_index, __STACK_TAG_OF(top) + 1);
+    } while (!__atomic_compare_exchange_n(list, &top, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return __STACK_INDEX_OF(top);
+}
+
+#ifndef STACK_CAPACITY
+// Adds the next chunk of nodes to the free list. Returns -3 if it could not be allocated.
+static inline int __EXPAND_CONCAT(STACK_NAME,_grow)(STACK_NAME* s) {
+    const uint32_t k = __atomic_load_n(&s->chunk_count, __ATOMIC_ACQUIRE);
+    const uint64_t first = (((uint64_t) 1 << k) - 1) << s->chunk_shift;
+    const uint64_t count = (uint64_t) 1 << (s->chunk_shift + k);
+
+    // All indices must stay below __STACK_NIL
+    if (k >= 32 || first + count >= __STACK_NIL)
+        return -3;
+
+    __EXPAND_CONCAT(STACK_NAME,_node)* chunk = (__EXPAND_CONCAT(STACK_NAME,_node)*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, count * sizeof(__EXPAND_CONCAT(STACK_NAME,_node)));
+    if (!chunk)
+        return -3;
+
+    // Another thread got here first, and its chunk is about to show up in the free list
+    __EXPAND_CONCAT(STACK_NAME,_node)* expected = NULL;
+    if (!__atomic_compare_exchange_n(&s->chunks[k], &expected, chunk, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, chunk, count * sizeof(__EXPAND_CONCAT(STACK_NAME,_node)));
+        return 0;
+    }
+
+    // Chain the new nodes together, and hand them to the free list at once
+    for (uint32_t i = 0; i < count - 1; i++)
+        chunk[i].next = first + i + 1;
+
+    __EXPAND_CONCAT(STACK_NAME,_list_push)(s, &s->free, first, first + count - 1);
+    __atomic_store_n(&s->chunk_count, k + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+#endif
+
+static inline int __EXPAND_CONCAT(STACK_NAME,_create)(
+    #ifdef STACK_CAPACITY
+    STACK_NAME* s
+
+    #else
+    STACK_NAME* s,
+    const STACK_INDEX initial_capacity
+
+    #endif
+) {
+    s->size = 0;
+    s->top = __STACK_PACK(__STACK_NIL, 0);
+    s->shutting_down = false;
+
+    #ifdef STACK_CAPACITY
+    // Every node starts out free
+    for (uint32_t i = 0; i < STACK_CAPACITY; i++)
+        s->nodes[i].next = i + 1 < STACK_CAPACITY ? i + 1 : __STACK_NIL;
+
+    s->free = __STACK_PACK(0, 0);
+
+    #else
+    // The first chunk holds at least `initial_capacity` and `STACK_MIN_CAPACITY` nodes, rounded up to a power of two
+    const STACK_INDEX starting_capacity = initial_capacity > STACK_MIN_CAPACITY ? initial_capacity : STACK_MIN_CAPACITY;
+
+    s->chunk_shift = 0;
+    while (((uint64_t) 1 << s->chunk_shift) < starting_capacity)
+        s->chunk_shift++;
+
+    s->free = __STACK_PACK(__STACK_NIL, 0);
+    s->chunk_count = 0;
+    memset(s->chunks, 0, sizeof(s->chunks));
+
+    if (__EXPAND_CONCAT(STACK_NAME,_grow)(s))
+        return -1;
+
+    #endif
+
+    return 0;
+}
+
+static inline void __EXPAND_CONCAT(STACK_NAME,_shutdown)(STACK_NAME* s) {
+    __atomic_store_n(&s->shutting_down, true, __ATOMIC_RELEASE);
+}
+
+static inline void __EXPAND_CONCAT(STACK_NAME,_destroy)(STACK_NAME* s) {
+    #ifdef STACK_CAPACITY
+    (void) s;
+    #else
+    for (uint32_t k = 0; k < s->chunk_count; k++)
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, s->chunks[k], ((size_t) 1 << (s->chunk_shift + k)) * sizeof(__EXPAND_CONCAT(STACK_NAME,_node)));
+    #endif
+}
+
+static inline STACK_INDEX __EXPAND_CONCAT(STACK_NAME,_size)(STACK_NAME* s) {
+    // Only exact while no other thread is pushing or popping
+    return __atomic_load_n(&s->size, __ATOMIC_RELAXED);
+}
+
+static inline int __EXPAND_CONCAT(STACK_NAME,_push)(STACK_NAME* s, STACK_TYPE value) {
+    // Cancel if the stack is shutting down
+    if (__atomic_load_n(&s->shutting_down, __ATOMIC_ACQUIRE))
+        return -2;
+
+    // Take a free node, adding more of them if there are none left
+    uint32_t index;
+    while ((index = __EXPAND_CONCAT(STACK_NAME,_list_pop)(s, &s->free)) == __STACK_NIL) {
+        #ifdef STACK_CAPACITY
+        return -1;
+        #else
+        if (__EXPAND_CONCAT(STACK_NAME,_grow)(s))
+            return -3;
+        #endif
+    }
+
+    __EXPAND_CONCAT(STACK_NAME,_node_at)(s, index)->value = value;
+    __EXPAND_CONCAT(STACK_NAME,_list_push)(s, &s->top, index, index);
+
+    __atomic_add_fetch(&s->size, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static inline int __EXPAND_CONCAT(STACK_NAME,_pop) (STACK_NAME* s, STACK_TYPE* dst) {
+    // If the stack is shutting down, skip
+    if (__atomic_load_n(&s->shutting_down, __ATOMIC_ACQUIRE))
+        return -2;
+
+    // Return error code if the stack is empty
+    const uint32_t index = __EXPAND_CONCAT(STACK_NAME,_list_pop)(s, &s->top);
+    if (index == __STACK_NIL)
+        return -1;
+
+    // The node is ours until it is handed back to the free list
+    *dst = __EXPAND_CONCAT(STACK_NAME,_node_at)(s, index)->value;
+    __EXPAND_CONCAT(STACK_NAME,_list_push)(s, &s->free, index, index);
+
+    __atomic_sub_fetch(&s->size, 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+/**
+ * @brief Pushes `count` elements, in the order they appear in `src`, so that the last of them ends up on top.
+ *
+ * Like the locking stack, either the whole batch is pushed or none of it. The nodes are taken one at a time
+ * and chained together privately, and then the chain is put on top with a single compare-and-swap.
+ *
+ * @return 0 on success, -1 if the elements do not fit into a stack with STACK_CAPACITY,
+ *         -2 if the stack is shutting down, or -3 on allocation failure.
+ */
+static inline int __EXPAND_CONCAT(STACK_NAME,_push_n)(STACK_NAME* s, const STACK_TYPE* src, const STACK_INDEX count) {
+    // Cancel if the stack is shutting down
+    if (__atomic_load_n(&s->shutting_down, __ATOMIC_ACQUIRE))
+        return -2;
+
+    if (count == 0)
+        return 0;
+
+    // The chain runs from the node of the last element, which becomes the top, down to the node of the first
+    uint32_t first = __STACK_NIL;
+    uint32_t last = __STACK_NIL;
+
+    for (STACK_INDEX i = 0; i < count; i++) {
+        uint32_t index;
+        int res = 0;
+
+        while ((index = __EXPAND_CONCAT(STACK_NAME,_list_pop)(s, &s->free)) == __STACK_NIL) {
+            #ifdef STACK_CAPACITY
+            res = -1;
+            #else
+            res = __EXPAND_CONCAT(STACK_NAME,_grow)(s);
+            #endif
+
+            if (res)
+                break;
+        }
+
+        // Hand the nodes taken so far back to the free list, so that nothing is pushed
+        if (res) {
+            if (first != __STACK_NIL)
+                __EXPAND_CONCAT(STACK_NAME,_list_push)(s, &s->free, first, last);
+
+            return res;
+        }
+
+        __EXPAND_CONCAT(STACK_NAME,_node)* node = __EXPAND_CONCAT(STACK_NAME,_node_at)(s, index);
+        node->value = src[i];
+
+        // Another thread may still be reading `next` from when the node was on a list
+        __atomic_store_n(&node->next, first, __ATOMIC_RELAXED);
+
+        if (last == __STACK_NIL)
+            last = index;
+        first = index;
+    }
+
+    __EXPAND_CONCAT(STACK_NAME,_list_push)(s, &s->top, first, last);
+
+    __atomic_add_fetch(&s->size, count, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+// There is no way to take several nodes off the top with a single compare-and-swap, since another thread
+// may pop any of them meanwhile, so a batch is popped one element at a time. Other threads may push and pop in between.
+static inline ssize_t __EXPAND_CONCAT(STACK_NAME,_pop_n)(STACK_NAME* s, STACK_TYPE* dst, const STACK_INDEX max) {
+    STACK_INDEX count = 0;
+    int res = 0;
+
+    while (count < max && (res = __EXPAND_CONCAT(STACK_NAME,_pop)(s, &dst[count])) == 0)
+        count++;
+
+    if (res == -2 && count == 0)
+        return -2;
+
+    // Put the elements in the order they were pushed, like the locking stack does
+    for (STACK_INDEX i = 0; i < count / 2; i++) {
+        STACK_TYPE tmp = dst[i];
+        dst[i] = dst[count - 1 - i];
+        dst[count - 1 - i] = tmp;
+    }
+
+    return count;
+}
+
+#undef __STACK_NIL
+#undef __STACK_PACK
+#undef __STACK_INDEX_OF
+#undef __STACK_TAG_OF
+
+#else
+
+// With STACK_INLINE_CAPACITY, the first elements are stored in `inline_array`, and `array` points there
+// until the stack outgrows it. The stack must then not be copied or moved while it is in use.
+// The array is never shrunk below STACK_INLINE_CAPACITY, at which point it moves back into the struct.
+// The inline array may be smaller than STACK_MIN_CAPACITY, which then only applies once the stack spills.
+
+#ifdef STACK_INLINE_CAPACITY
+#define __STACK_SHRINK_LIMIT STACK_INLINE_CAPACITY
+#else
+#define __STACK_SHRINK_LIMIT STACK_MIN_CAPACITY
+#endif
 
 typedef struct STACK_NAME {
     STACK_INDEX size;
@@ -47,10 +387,66 @@ typedef struct STACK_NAME {
 
     #ifdef STACK_EXT_THREAD_SAFE
     pthread_mutex_t lock;
+    pthread_cond_t not_empty;
     bool shutting_down;
     #endif
+
+    #ifdef STACK_INLINE_CAPACITY
+    STACK_TYPE inline_array[STACK_INLINE_CAPACITY];
+    #endif
 } STACK_NAME;
 
+#ifndef STACK_CAPACITY
+// Moves the elements to an array of `new_capacity`, which must be at least the size. The caller holds the lock, if there is one.
+// Returns -3 if the array could not be allocated, in which case the stack is left as it was.
+static inline int __EXPAND_CONCAT(STACK_NAME,_resize_unlocked)(STACK_NAME* s, const STACK_INDEX new_capacity) {
+    #ifdef STACK_INLINE_CAPACITY
+
+    const bool is_inline = s->array == s->inline_array;
+
+    if (new_capacity <= STACK_INLINE_CAPACITY) {
+        if (!is_inline) {
+            // Move back into the struct
+            memcpy(s->inline_array, s->array, s->size * sizeof(STACK_TYPE));
+            CTOOLS_FREE(CTOOLS_ALLOC_CTX, s->array, s->capacity * sizeof(STACK_TYPE));
+
+            s->array = s->inline_array;
+            s->capacity = STACK_INLINE_CAPACITY;
+        }
+
+        return 0;
+    }
+
+    if (is_inline) {
+        // Spill to the heap
+        STACK_TYPE* new_array = (STACK_TYPE*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, new_capacity * sizeof(STACK_TYPE));
+        if (!new_array)
+            return -3;
+
+        memcpy(new_array, s->inline_array, s->size * sizeof(STACK_TYPE));
+
+        s->array = new_array;
+        s->capacity = new_capacity;
+
+        return 0;
+    }
+
+    #endif
+
+    STACK_TYPE* new_array = (STACK_TYPE*) CTOOLS_REALLOC(CTOOLS_ALLOC_CTX, s->array, s->capacity * sizeof(STACK_TYPE), new_capacity * sizeof(STACK_TYPE));
+
+    // If we failed to allocate more memory, return an error
+    if (!new_array)
+        return -3;
+
+    // Continue with the reallocated array
+    s->array = new_array;
+    s->capacity = new_capacity;
+
+    return 0;
+}
+#endif
+
 static inline int __EXPAND_CONCAT(STACK_NAME,_create)(
     #ifdef STACK_CAPACITY
     STACK_NAME* s
@@ -65,21 +461,48 @@ static inline int __EXPAND_CONCAT(STACK_NAME,_create)(
     if (pthread_mutex_init(&s->lock, NULL)) {
         return -1;
     }
+
+    // Let `_pop_wait` measure its timeouts on a clock that does not jump
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+    const int cond_res = pthread_cond_init(&s->not_empty, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (cond_res) {
+        pthread_mutex_destroy(&s->lock);
+        return -1;
+    }
     #endif
 
     #ifndef STACK_CAPACITY
     // Choose the largest of `initial_capacity` and `STACK_MIN_CAPACITY` as the starting capacity.
     const STACK_INDEX starting_capacity = initial_capacity > STACK_MIN_CAPACITY ? initial_capacity : STACK_MIN_CAPACITY;
 
-    s->array = (STACK_TYPE*) malloc(starting_capacity * sizeof(STACK_TYPE));
-    if (!s->array) {
+    #ifdef STACK_INLINE_CAPACITY
+    // Start out in the struct, and only spill right away if more than fits there is requested up front.
+    // STACK_MIN_CAPACITY only applies to the heap, so a smaller inline capacity is still used.
+    s->array = s->inline_array;
+    s->capacity = STACK_INLINE_CAPACITY;
+    s->size = 0;
+
+    const bool alloc_failed = initial_capacity > STACK_INLINE_CAPACITY &&
+                              __EXPAND_CONCAT(STACK_NAME,_resize_unlocked)(s, starting_capacity) != 0;
+    #else
+    s->array = (STACK_TYPE*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, starting_capacity * sizeof(STACK_TYPE));
+    s->capacity = starting_capacity;
+
+    const bool alloc_failed = !s->array;
+    #endif
+
+    if (alloc_failed) {
         #ifdef STACK_EXT_THREAD_SAFE
+        pthread_cond_destroy(&s->not_empty);
         pthread_mutex_destroy(&s->lock);
         #endif
         return -1;
     }
-
-    s->capacity = starting_capacity;
     #endif
 
     s->size = 0;
@@ -99,13 +522,21 @@ static inline void __EXPAND_CONCAT(STACK_NAME,_shutdown)(STACK_NAME* s) {
 
     s->shutting_down = true;
 
+    // Wake up every thread blocked in `_pop_wait`
+    pthread_cond_broadcast(&s->not_empty);
+
     // Unlock
     pthread_mutex_unlock(&s->lock);
 
+    #else
+    (void) s;
     #endif
 }
 
 static inline void __EXPAND_CONCAT(STACK_NAME,_destroy)(STACK_NAME* s) {
+    // Nothing to do for a fixed capacity stack without a lock
+    (void) s;
+
     // Aquire lock
     #ifdef STACK_EXT_THREAD_SAFE
     pthread_mutex_lock(&s->lock);
@@ -113,7 +544,10 @@ static inline void __EXPAND_CONCAT(STACK_NAME,_destroy)(STACK_NAME* s) {
     
     // Destroy all nodes in the stack
     #ifndef STACK_CAPACITY
-    free(s->array);
+    #ifdef STACK_INLINE_CAPACITY
+    if (s->array != s->inline_array)
+    #endif
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, s->array, s->capacity * sizeof(STACK_TYPE));
     #endif
 
     #ifdef STACK_EXT_THREAD_SAFE
@@ -122,6 +556,7 @@ static inline void __EXPAND_CONCAT(STACK_NAME,_destroy)(STACK_NAME* s) {
     pthread_mutex_unlock(&s->lock);
 
     // Destroy the lock
+    pthread_cond_destroy(&s->not_empty);
     pthread_mutex_destroy(&s->lock);
 
     #endif
@@ -143,6 +578,25 @@ static inline STACK_INDEX __EXPAND_CONCAT(STACK_NAME,_size)(STACK_NAME* s) {
     #endif
 }
 
+#ifndef STACK_CAPACITY
+// Makes room for `count` more elements. The caller holds the lock, if there is one.
+static inline int __EXPAND_CONCAT(STACK_NAME,_grow_unlocked)(STACK_NAME* s, const STACK_INDEX count) {
+    if (count <= s->capacity - s->size)
+        return 0;
+
+    // Double the capacity as many times as needed, so that a whole batch grows the array only once
+    STACK_INDEX new_capacity = s->capacity;
+    while (new_capacity - s->size < count) {
+        if (new_capacity > ((STACK_INDEX) -1) / 2)
+            return -3;
+
+        new_capacity *= 2;
+    }
+
+    return __EXPAND_CONCAT(STACK_NAME,_resize_unlocked)(s, new_capacity);
+}
+#endif
+
 static inline int __EXPAND_CONCAT(STACK_NAME,_push)(STACK_NAME* s, STACK_TYPE value) {
     #ifdef STACK_EXT_THREAD_SAFE
 
@@ -160,20 +614,11 @@ static inline int __EXPAND_CONCAT(STACK_NAME,_push)(STACK_NAME* s, STACK_TYPE va
     #ifndef STACK_CAPACITY
 
     // Increase capacity if the stack is full
-    if (s->size == s->capacity) {
-        STACK_TYPE* new_array = (STACK_TYPE*) realloc(s->array, 2 * s->capacity * sizeof(STACK_TYPE));
-        
-        // If we failed to allocate more memory, return an error
-        if (!new_array) {
-            #ifdef STACK_EXT_THREAD_SAFE
-            pthread_mutex_unlock(&s->lock);
-            #endif
-            return -3;
-        }
-        
-        // Continue with the reallocated array
-        s->array = new_array;
-        s->capacity *= 2;
+    if (__EXPAND_CONCAT(STACK_NAME,_grow_unlocked)(s, 1)) {
+        #ifdef STACK_EXT_THREAD_SAFE
+        pthread_mutex_unlock(&s->lock);
+        #endif
+        return -3;
     }
 
     #endif
@@ -182,14 +627,40 @@ static inline int __EXPAND_CONCAT(STACK_NAME,_push)(STACK_NAME* s, STACK_TYPE va
     // then increase the size counter
     s->array[s->size++] = value;
 
-    // Unlock
+    // Unlock, and wake up one thread blocked in `_pop_wait`, if any
     #ifdef STACK_EXT_THREAD_SAFE
     pthread_mutex_unlock(&s->lock);
+    pthread_cond_signal(&s->not_empty);
     #endif
 
     return 0;
 }
 
+// Removes the top element. The caller holds the lock, if there is one.
+static inline int __EXPAND_CONCAT(STACK_NAME,_pop_unlocked) (STACK_NAME* s, STACK_TYPE* dst) {
+    // Return error code if the stack is empty
+    if (s->size == 0)
+        return -1;
+
+    // Decrease size counter by one,
+    // then assign the removed value to the destination pointer
+    *dst = s->array[--s->size];
+
+    #ifndef STACK_CAPACITY
+
+    // Decrease capacity if the stack size is a quarter of the capacity
+    if ((s->size <= s->capacity / 4) && (s->capacity / 2 >= __STACK_SHRINK_LIMIT)) {
+        // If we failed to allocate more memory, return an error
+        if (__EXPAND_CONCAT(STACK_NAME,_resize_unlocked)(s, s->capacity / 2))
+            return -3;
+    }
+
+    #endif
+
+    // Return success
+    return 0;
+}
+
 static inline int __EXPAND_CONCAT(STACK_NAME,_pop) (STACK_NAME* s, STACK_TYPE* dst) {
     #ifdef STACK_EXT_THREAD_SAFE
 
@@ -204,46 +675,236 @@ static inline int __EXPAND_CONCAT(STACK_NAME,_pop) (STACK_NAME* s, STACK_TYPE* d
 
     #endif
 
-    // Return error code if the stack is empty
-    if (s->size == 0) {
-        #ifdef STACK_EXT_THREAD_SAFE
+    const int res = __EXPAND_CONCAT(STACK_NAME,_pop_unlocked)(s, dst);
+    
+    // Unlock
+    #ifdef STACK_EXT_THREAD_SAFE
+    pthread_mutex_unlock(&s->lock);
+    #endif
+
+    return res;
+}
+
+/**
+ * @brief Pushes `count` elements, in the order they appear in `src`, so that the last of them ends up on top.
+ *
+ * Takes the lock once, and grows the array at most once, for the whole batch.
+ *
+ * @return 0 on success, -1 if the elements do not fit into a stack with STACK_CAPACITY, in which case none are pushed,
+ *         -2 if the stack is shutting down, or -3 on allocation failure.
+ */
+static inline int __EXPAND_CONCAT(STACK_NAME,_push_n)(STACK_NAME* s, const STACK_TYPE* src, const STACK_INDEX count) {
+    #ifdef STACK_EXT_THREAD_SAFE
+
+    // Lock
+    pthread_mutex_lock(&s->lock);
+
+    // Cancel if the stack is shutting down
+    if (s->shutting_down) {
         pthread_mutex_unlock(&s->lock);
-        #endif
+        return -2;
+    }
 
-        return -1;
+    #endif
+
+    #ifdef STACK_CAPACITY
+    const int res = count > STACK_CAPACITY - s->size ? -1 : 0;
+    #else
+    const int res = __EXPAND_CONCAT(STACK_NAME,_grow_unlocked)(s, count);
+    #endif
+
+    if (res == 0) {
+        memcpy(&s->array[s->size], src, count * sizeof(STACK_TYPE));
+        s->size += count;
     }
 
-    // Decrease size counter by one,
-    // then assign the removed value to the destination pointer
-    *dst = s->array[--s->size];
+    // Unlock, and wake up the threads blocked in `_pop_wait`, if any
+    #ifdef STACK_EXT_THREAD_SAFE
+    pthread_mutex_unlock(&s->lock);
+    if (res == 0 && count > 0)
+        pthread_cond_broadcast(&s->not_empty);
+    #endif
 
-    #ifndef STACK_CAPACITY
+    return res;
+}
 
-    // Decrease capacity if the stack size is a quarter of the capacity
-    if ((s->size <= s->capacity / 4) && (s->capacity / 2 >= STACK_MIN_CAPACITY)) {
-        STACK_TYPE* new_array = (STACK_TYPE*) realloc(s->array, (s->capacity / 2) * sizeof(STACK_TYPE));
-        
-        // If we failed to allocate more memory, return an error
-        if (!new_array) {
-            #ifdef STACK_EXT_THREAD_SAFE
-            pthread_mutex_unlock(&s->lock);
-            #endif
+/**
+ * @brief Pops up to `max` elements from the top of the stack.
+ *
+ * The elements are written to `dst` in the order they were pushed, i.e. the former top element comes last,
+ * so passing them to `_push_n` restores the stack. Takes the lock once for the whole batch.
+ *
+ * @return The number of elements popped, which is 0 if the stack is empty, or -2 if the stack is shutting down.
+ */
+static inline ssize_t __EXPAND_CONCAT(STACK_NAME,_pop_n)(STACK_NAME* s, STACK_TYPE* dst, const STACK_INDEX max) {
+    #ifdef STACK_EXT_THREAD_SAFE
 
-            return -3;
-        }
-        
-        s->array = new_array;
-        s->capacity /= 2;
+    // Lock
+    pthread_mutex_lock(&s->lock);
+
+    // If the stack is shutting down, skip
+    if (s->shutting_down) {
+        pthread_mutex_unlock(&s->lock);
+        return -2;
     }
 
     #endif
 
-    
+    const STACK_INDEX count = max < s->size ? max : s->size;
+
+    // The top `count` elements form one contiguous run
+    s->size -= count;
+    memcpy(dst, &s->array[s->size], count * sizeof(STACK_TYPE));
+
+    #ifndef STACK_CAPACITY
+
+    // Shrink the array once, by as much as single pops would have done
+    STACK_INDEX new_capacity = s->capacity;
+    while ((s->size <= new_capacity / 4) && (new_capacity / 2 >= __STACK_SHRINK_LIMIT))
+        new_capacity /= 2;
+
+    // Keeping the larger array is harmless, so a failure is not worth reporting here
+    if (new_capacity != s->capacity)
+        __EXPAND_CONCAT(STACK_NAME,_resize_unlocked)(s, new_capacity);
+
+    #endif
+
     // Unlock
     #ifdef STACK_EXT_THREAD_SAFE
     pthread_mutex_unlock(&s->lock);
     #endif
 
-    // Return success
+    return count;
+}
+
+#ifdef STACK_EXT_THREAD_SAFE
+
+/**
+ * @brief Pops the top element, waiting for one to be pushed if the stack is empty.
+ * @param timeout_ms The longest time to wait, or a negative value to wait forever. 0 does not wait.
+ * @return 0 on success, -1 if the stack was still empty when the time ran out,
+ *         -2 if the stack is shutting down, or was shut down while waiting, or -3 on allocation failure.
+ */
+static inline int __EXPAND_CONCAT(STACK_NAME,_pop_wait) (STACK_NAME* s, STACK_TYPE* dst, const int timeout_ms) {
+    // The deadline is measured on the same clock as the condition variable
+    struct timespec deadline;
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    // Lock
+    pthread_mutex_lock(&s->lock);
+
+    // Sleep until something is pushed, the stack shuts down, or the time runs out.
+    // Spurious wake-ups and other consumers taking the element first lead back here.
+    while (s->size == 0 && !s->shutting_down && timeout_ms != 0) {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&s->not_empty, &s->lock);
+        else if (pthread_cond_timedwait(&s->not_empty, &s->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+
+    // If the stack is shutting down, skip
+    if (s->shutting_down) {
+        pthread_mutex_unlock(&s->lock);
+        return -2;
+    }
+
+    const int res = __EXPAND_CONCAT(STACK_NAME,_pop_unlocked)(s, dst);
+
+    // Unlock
+    pthread_mutex_unlock(&s->lock);
+
+    return res;
+}
+
+#endif
+
+#undef __STACK_SHRINK_LIMIT
+
+#endif // STACK_EXT_LOCK_FREE
+
+
+
+#ifdef STACK_MAGAZINE_SIZE
+
+// A magazine is a small, unsynchronized cache of elements in front of a shared stack, meant to be owned by one thread,
+// e.g. through a thread-local variable. Pushes and pops only touch the magazine, until it is full or empty.
+// Then `STACK_MAGAZINE_SIZE` elements are exchanged with the shared stack in a single `_push_n` or `_pop_n`.
+//
+// The magazine has room for twice that many elements, so a thread alternating between pushes and pops
+// right at the boundary does not go to the shared stack every time.
+//
+// The shared stack may be any configuration, including STACK_EXT_LOCK_FREE. Each of them pushes a batch
+// either entirely or not at all, so an element is never left both in the magazine and on the shared stack.
+
+typedef struct __EXPAND_CONCAT(STACK_NAME,_magazine) {
+    STACK_NAME* shared;
+    STACK_INDEX count;
+    STACK_TYPE items[2 * STACK_MAGAZINE_SIZE];
+} __EXPAND_CONCAT(STACK_NAME,_magazine);
+
+static inline void __EXPAND_CONCAT(STACK_NAME,_magazine_init)(__EXPAND_CONCAT(STACK_NAME,_magazine)* m, STACK_NAME* shared) {
+    m->shared = shared;
+    m->count = 0;
+}
+
+/**
+ * @brief Pushes an element into the magazine, handing its oldest elements to the shared stack if it is full.
+ * @return 0 on success, or the error of `_push_n` on the shared stack, in which case nothing is pushed.
+ */
+static inline int __EXPAND_CONCAT(STACK_NAME,_magazine_push)(__EXPAND_CONCAT(STACK_NAME,_magazine)* m, STACK_TYPE value) {
+    if (m->count == 2 * STACK_MAGAZINE_SIZE) {
+        const int res = __EXPAND_CONCAT(STACK_NAME,_push_n)(m->shared, m->items, STACK_MAGAZINE_SIZE);
+        if (res)
+            return res;
+
+        // Keep the most recently pushed elements, which are the most likely to still be in the cache
+        memmove(m->items, &m->items[STACK_MAGAZINE_SIZE], STACK_MAGAZINE_SIZE * sizeof(STACK_TYPE));
+        m->count = STACK_MAGAZINE_SIZE;
+    }
+
+    m->items[m->count++] = value;
+
     return 0;
 }
+
+/**
+ * @brief Pops an element from the magazine, refilling it from the shared stack if it is empty.
+ * @return 0 on success, -1 if both the magazine and the shared stack are empty,
+ *         or -2 if the shared stack is shutting down.
+ */
+static inline int __EXPAND_CONCAT(STACK_NAME,_magazine_pop)(__EXPAND_CONCAT(STACK_NAME,_magazine)* m, STACK_TYPE* dst) {
+    if (m->count == 0) {
+        const ssize_t res = __EXPAND_CONCAT(STACK_NAME,_pop_n)(m->shared, m->items, STACK_MAGAZINE_SIZE);
+        if (res <= 0)
+            return res == 0 ? -1 : (int) res;
+
+        m->count = res;
+    }
+
+    *dst = m->items[--m->count];
+
+    return 0;
+}
+
+/**
+ * @brief Hands every element in the magazine to the shared stack, e.g. before its thread exits.
+ * @return 0 on success, or the error of `_push_n` on the shared stack, in which case the magazine keeps its elements.
+ */
+static inline int __EXPAND_CONCAT(STACK_NAME,_magazine_flush)(__EXPAND_CONCAT(STACK_NAME,_magazine)* m) {
+    const int res = __EXPAND_CONCAT(STACK_NAME,_push_n)(m->shared, m->items, m->count);
+    if (res == 0)
+        m->count = 0;
+
+    return res;
+}
+
+#endif // STACK_MAGAZINE_SIZE
@@ -0,0 +1,125 @@
+#ifndef CTOOLS_URING
+#define CTOOLS_URING
+
+#include <stddef.h>
+
+#include "ctools/cbuf.h"
+
+/**
+ * An asynchronous I/O engine that moves data between file descriptors and circular buffers through io_uring.
+ *
+ * Reads into and writes out of any number of `struct ct_cbuf` instances are queued with ct_uring_prep_fill()
+ * and ct_uring_prep_drain(), handed to the kernel in one batch with ct_uring_submit(), and their completions
+ * are reaped in bulk with ct_uring_reap(). Every transfer targets the contiguous span that the doubled mapping
+ * of the circular buffer guarantees, so one operation always covers all of its free or occupied space.
+ *
+ * Talks to the kernel through the raw io_uring system calls, so no liburing is needed.
+ */
+struct ct_uring {
+    int ring_fd;
+
+    unsigned int sq_entries;
+    unsigned int sq_tail;
+    unsigned int sq_submitted;
+    unsigned int* sq_khead;
+    unsigned int* sq_ktail;
+    unsigned int* sq_kmask;
+    unsigned int* sq_karray;
+    struct io_uring_sqe* sqes;
+
+    unsigned int* cq_khead;
+    unsigned int* cq_ktail;
+    unsigned int* cq_kmask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+enum ct_uring_op_type {
+    CT_URING_FILL,
+    CT_URING_DRAIN,
+};
+
+/**
+ * A single transfer between a file descriptor and a circular buffer.
+ *
+ * Owned by the caller, typically embedded in a per-connection struct, and must stay alive until it is reaped.
+ * Only one fill and one drain may be in flight for each circular buffer at a time.
+ */
+struct ct_uring_op {
+    struct ct_cbuf* cbuf;
+    enum ct_uring_op_type type;
+
+    // The number of bytes transferred, 0 on end-of-file, or a negated errno value. Set when the op is reaped.
+    int result;
+
+    // Not used by the engine
+    void* user_data;
+};
+
+/**
+ * @brief Sets up an io_uring instance.
+ * @param ring The engine to initialize.
+ * @param entries The number of operations that may be queued before they have to be submitted.
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_uring_init(struct ct_uring* ring, const unsigned int entries);
+
+void ct_uring_exit(struct ct_uring* ring);
+
+/**
+ * @brief Registers the memory of a set of circular buffers with the kernel.
+ *
+ * The kernel then keeps the pages of each buffer pinned, instead of looking them up on every transfer.
+ * Each buffer is registered with its index in @p cbufs, which is passed as `buf_index` when queueing transfers.
+ * Replaces any previously registered set.
+ *
+ * @return 0 on success, or -1 on error with errno set.
+ */
+int ct_uring_register_cbufs(struct ct_uring* ring, struct ct_cbuf* const* cbufs, const unsigned int count);
+
+int ct_uring_unregister_cbufs(struct ct_uring* ring);
+
+/**
+ * @brief Queues a read from @p fd into all free space of @p cbuf.
+ *
+ * The bytes read are committed to the circular buffer when the operation is reaped.
+ *
+ * @param buf_index The index that @p cbuf was registered with, or -1 if it is not registered.
+ * @return 0 on success, or -1 on error with errno set.
+ *         Fails with ENOBUFS if @p cbuf is full, and with EBUSY if the submission queue is full.
+ */
+int ct_uring_prep_fill(struct ct_uring* ring, struct ct_uring_op* op, struct ct_cbuf* cbuf, int fd, int buf_index);
+
+/**
+ * @brief Queues a write of all occupied space of @p cbuf to @p fd.
+ *
+ * The bytes written are consumed from the circular buffer when the operation is reaped.
+ *
+ * @param buf_index The index that @p cbuf was registered with, or -1 if it is not registered.
+ * @return 0 on success, or -1 on error with errno set.
+ *         Fails with ENODATA if @p cbuf is empty, and with EBUSY if the submission queue is full.
+ */
+int ct_uring_prep_drain(struct ct_uring* ring, struct ct_uring_op* op, struct ct_cbuf* cbuf, int fd, int buf_index);
+
+/**
+ * @brief Hands all queued operations to the kernel with a single system call.
+ * @param wait_count The number of completions to wait for before returning.
+ * @return The number of operations submitted, or -1 on error with errno set.
+ */
+int ct_uring_submit(struct ct_uring* ring, const unsigned int wait_count);
+
+/**
+ * @brief Collects finished operations and applies their results to the circular buffers.
+ * @param done Filled with the finished operations.
+ * @param max The capacity of @p done.
+ * @param min_count Blocks until at least this many operations have finished.
+ * @return The number of operations written to @p done, or -1 on error with errno set.
+ */
+int ct_uring_reap(struct ct_uring* ring, struct ct_uring_op** done, const unsigned int max, const unsigned int min_count);
+
+#endif // CTOOLS_URING
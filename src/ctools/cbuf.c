@@ -1,72 +1,501 @@
 #define _GNU_SOURCE
 #include <linux/memfd.h>
+#include <linux/futex.h>
 #include <stddef.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include "ctools/cbuf.h"
 
+// Identifies the control page of a ct_cbuf_spsc
+#define SPSC_MAGIC 0x43544342
+
+// Identifies the header page of a file-backed ct_cbuf
+#define JOURNAL_MAGIC 0x43544a4c
+
+/**
+ * The header page in front of the data of a file-backed ct_cbuf.
+ * The indices are only updated by ct_cbuf_sync(), after the data they cover is on the disk.
+ */
+struct journal_header {
+    uint32_t magic;
+    uint32_t index_size;
+    uint64_t capacity;
+    uint64_t page_size;
+    uint64_t head;
+    uint64_t tail;
+};
+
+// How many times a waiter polls the other side's index before it goes to sleep
+#define SPSC_SPIN_COUNT 1024
+
 static inline size_t page_align_up(size_t size, size_t page_size) {
     return (size + page_size - 1) & ~(page_size - 1);
 }
 
-int ct_cbuf_init(struct ct_cbuf* buf, const unsigned int min_capacity) {
-    // The capacity must be page-aligned
-    unsigned int capacity = page_align_up(min_capacity, sysconf(_SC_PAGESIZE));
+/**
+ * Maps `capacity` bytes of `fd`, starting at `offset`, twice in a row into a fresh range of address space.
+ * The start of the range is aligned to `alignment`, which must be a multiple of the system's page size.
+ *
+ * @returns The start of the doubled mapping, or NULL on error.
+ */
+static void* map_mirror(int fd, off_t offset, size_t capacity, size_t alignment) {
+    // Reserve address space, with enough slack to align the start of it
+    const size_t reserved_size = capacity * 2 + alignment - sysconf(_SC_PAGESIZE);
+    void* reserved = mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED)
+        return NULL;
+
+    // Give back the slack on both sides of the aligned range
+    void* addr = (void*) page_align_up((size_t) reserved, alignment);
+    if (addr != reserved)
+        munmap(reserved, addr - reserved);
+    if (addr + capacity * 2 != reserved + reserved_size)
+        munmap(addr + capacity * 2, (reserved + reserved_size) - (addr + capacity * 2));
+
+    // Map both halves of the address space
+    if (mmap(addr,            capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED ||
+        mmap(addr + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        munmap(addr, capacity * 2);
+        return NULL;
+    }
+
+    return addr;
+}
+
+/**
+ * The memory behind a circular buffer: a memfd holding `header_size` bytes
+ * in front of `capacity` bytes of data, where the data is mapped twice in a row at `buffer`.
+ */
+struct mirror {
+    int fd;
+    void* buffer;
+    void* header;
+    size_t header_size;
+    size_t capacity;
+    size_t page_size;
+};
+
+/**
+ * Creates the memfd and the mappings of a circular buffer.
+ *
+ * Tries the huge page sizes requested in `flags` from the largest to the smallest, and falls back to normal pages
+ * when the system has no huge pages of that size to spare. Both the header and the capacity are rounded up
+ * to the page size in use, and the header is only mapped when `with_header` is set.
+ *
+ * @returns 0 on success, or -1 on error.
+ */
+static int create_mirror(struct mirror* mirror, size_t min_capacity, int flags, int with_header) {
+    const struct {
+        int required_flag;
+        unsigned int memfd_flags;
+        size_t page_size;
+    } candidates[] = {
+        { CT_CBUF_HUGE_1GB, MFD_HUGETLB | MFD_HUGE_1GB, (size_t) 1 << 30 },
+        { CT_CBUF_HUGE_2MB, MFD_HUGETLB | MFD_HUGE_2MB, (size_t) 1 << 21 },
+        { 0,                0,                          sysconf(_SC_PAGESIZE) },
+    };
+
+    for (unsigned int i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (candidates[i].required_flag && !(flags & candidates[i].required_flag))
+            continue;
+
+        const int fallback = candidates[i].required_flag == 0;
+        const size_t page_size = candidates[i].page_size;
+
+        // The capacity must be page-aligned
+        const size_t capacity = page_align_up(min_capacity ? min_capacity : 1, page_size);
+        const size_t header_size = with_header ? page_size : 0;
+
+        // Both indices must be able to address the doubled address space
+        if (capacity > ((CT_CBUF_INDEX) -1) / 2) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        // Create anonymous memory object
+        int fd = memfd_create("mirror", candidates[i].memfd_flags);
+        if (fd < 0) {
+            if (fallback)
+                perror("memfd_create");
+            continue;
+        }
+
+        if (ftruncate(fd, header_size + capacity)) {
+            if (fallback)
+                perror("ftruncate");
+            close(fd);
+            continue;
+        }
+
+        void* header = NULL;
+        if (with_header) {
+            header = mmap(NULL, header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (header == MAP_FAILED) {
+                if (fallback)
+                    perror("mmap");
+                close(fd);
+                continue;
+            }
+        }
+
+        void* buffer = map_mirror(fd, header_size, capacity, page_size);
+        if (!buffer) {
+            if (fallback)
+                perror("mmap");
+            if (header)
+                munmap(header, header_size);
+            close(fd);
+            continue;
+        }
+
+        *mirror = (struct mirror) {
+            .fd = fd,
+            .buffer = buffer,
+            .header = header,
+            .header_size = header_size,
+            .capacity = capacity,
+            .page_size = page_size,
+        };
+
+        return 0;
+    }
+
+    return -1;
+}
+
+int ct_cbuf_init(struct ct_cbuf* buf, const CT_CBUF_INDEX min_capacity) {
+    return ct_cbuf_init_ex(buf, min_capacity, 0);
+}
 
-    // Create anonymous memory object
-    int fd = memfd_create("mirror", 0);
-    if (fd < 0) {
-        perror("memfd_create");
+int ct_cbuf_init_ex(struct ct_cbuf* buf, const CT_CBUF_INDEX min_capacity, const int flags) {
+    struct mirror mirror;
+    if (create_mirror(&mirror, min_capacity, flags, 0))
+        return -1;
+
+    *buf = (struct ct_cbuf) {
+        .buffer = mirror.buffer,
+        .memfd = mirror.fd,
+        .capacity = mirror.capacity,
+        .head = 0,
+        .tail = 0,
+        .page_size = mirror.page_size,
+    };
+
+    return 0;
+}
+
+int ct_cbuf_init_file(struct ct_cbuf* buf, int fd, const CT_CBUF_INDEX min_capacity) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    struct stat st;
+    if (fstat(fd, &st))
+        return -1;
+
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
         return -1;
     }
 
-    if (ftruncate(fd, capacity)) {
-        perror("ftruncate");
+    // Keep our own reference to the file, like the memfd of other buffers
+    fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
         return -1;
+
+    const int fresh = st.st_size == 0;
+    const size_t capacity = page_align_up(min_capacity ? min_capacity : 1, page_size);
+    const uint64_t file_size = fresh ? page_size + capacity : (uint64_t) st.st_size;
+
+    if (fresh) {
+        // Both indices must be able to address the doubled address space
+        if (capacity > ((CT_CBUF_INDEX) -1) / 2) {
+            close(fd);
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        if (ftruncate(fd, page_size + capacity)) {
+            const int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
     }
 
-    // Reserve address space
-    void* addr = mmap(NULL, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (addr == (void*)-1) {
-        perror("mmap");
+    struct journal_header* header = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        const int error = errno;
+        close(fd);
+        errno = error;
         return -1;
     }
 
-    // Map both halves of the address space
-    mmap(addr,            capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
-    mmap(addr + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (fresh) {
+        *header = (struct journal_header) {
+            .index_size = sizeof(CT_CBUF_INDEX),
+            .capacity = capacity,
+            .page_size = page_size,
+            .head = 0,
+            .tail = 0,
+        };
+
+        // A file that was created but never got its header reads as zeroes, which is rejected rather than trusted
+        header->magic = JOURNAL_MAGIC;
+        msync(header, page_size, MS_SYNC);
+    }
+
+    // Make sure the file holds a buffer with the layout this process expects, and indices that make sense
+    if (header->magic != JOURNAL_MAGIC ||
+        header->index_size != sizeof(CT_CBUF_INDEX) ||
+        header->page_size != page_size ||
+        file_size != page_size + header->capacity ||
+        header->tail >= header->capacity ||
+        header->head < header->tail ||
+        header->head - header->tail > header->capacity) {
+        munmap(header, page_size);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* addr = map_mirror(fd, page_size, header->capacity, page_size);
+    if (!addr) {
+        const int error = errno;
+        munmap(header, page_size);
+        close(fd);
+        errno = error;
+        return -1;
+    }
 
     *buf = (struct ct_cbuf) {
         .buffer = addr,
         .memfd = fd,
-        .capacity = capacity,
-        .head = 0,
-        .tail = 0,
+        .capacity = header->capacity,
+        .head = header->head,
+        .tail = header->tail,
+        .page_size = page_size,
+        .journal = header,
     };
 
     return 0;
 }
 
+int ct_cbuf_sync(struct ct_cbuf* buf) {
+    struct journal_header* header = buf->journal;
+
+    if (!header) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The data has to be on the disk before the header points past it
+    if (msync(buf->buffer, buf->capacity, MS_SYNC))
+        return -1;
+
+    header->head = buf->head;
+    header->tail = buf->tail;
+
+    return msync(header, buf->page_size, MS_SYNC);
+}
+
+int ct_cbuf_sync_start(struct ct_cbuf* buf) {
+    if (!buf->journal) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return sync_file_range(buf->memfd, buf->page_size, buf->capacity, SYNC_FILE_RANGE_WRITE);
+}
+
 void ct_cbuf_exit(struct ct_cbuf* buf) {
-    munmap(buf->buffer, buf->capacity * 2);
+    if (buf->journal) {
+        ct_cbuf_sync(buf);
+        munmap(buf->journal, buf->page_size);
+    }
+
+    munmap(buf->buffer, (size_t) buf->capacity * 2);
     close(buf->memfd);
 
     // Zero out the struct
     memset(buf, 0, sizeof(struct ct_cbuf));
 }
 
-int ct_cbuf_read(struct ct_cbuf* buf, void* dst, unsigned int read_count) {
+int ct_cbuf_grow(struct ct_cbuf* buf, const CT_CBUF_INDEX min_capacity) {
+    const size_t old_capacity = buf->capacity;
+    const size_t new_capacity = page_align_up(min_capacity, buf->page_size);
+
+    if (new_capacity <= old_capacity)
+        return 0;
+
+    // Buffers handed out by a ct_cbuf_pool share a memfd, which must keep its size.
+    // The data of file-backed buffers does not start at the beginning of the file.
+    if (buf->memfd < 0 || buf->journal) {
+        errno = EPERM;
+        return -1;
+    }
+
+    // Both indices must be able to address the doubled address space
+    if (new_capacity > ((CT_CBUF_INDEX) -1) / 2) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    // The existing pages keep their offsets in the memfd, so the data stays where it is
+    if (ftruncate(buf->memfd, new_capacity))
+        return -1;
+
+    void* addr = map_mirror(buf->memfd, 0, new_capacity, buf->page_size);
+    if (!addr) {
+        const int error = errno;
+        ftruncate(buf->memfd, old_capacity);
+        errno = error;
+        return -1;
+    }
+
+    CT_CBUF_INDEX head = buf->head;
+    CT_CBUF_INDEX tail = buf->tail;
+
+    // When the data wraps around the end of the old capacity, the part written after the wrap sits at the start
+    // of the memfd, and no longer directly follows the older part once the new pages are in between.
+    // Only the shorter of the two parts is moved next to the other one.
+    if (head > old_capacity) {
+        const size_t wrapped = head - old_capacity;
+        const size_t unwrapped = old_capacity - tail;
+        const size_t growth = new_capacity - old_capacity;
+
+        if (wrapped <= unwrapped && wrapped <= growth) {
+            // Append the wrapped part to the older part
+            memcpy(addr + old_capacity, addr, wrapped);
+        } else {
+            // Move the older part to the end of the new capacity, in front of the wrapped part
+            memmove(addr + tail + growth, addr + tail, unwrapped);
+            head += growth;
+            tail += growth;
+        }
+    }
+
+    munmap(buf->buffer, old_capacity * 2);
+
+    buf->buffer = addr;
+    buf->capacity = new_capacity;
+    buf->head = head;
+    buf->tail = tail;
+
+    return 0;
+}
+
+int ct_cbuf_shrink(struct ct_cbuf* buf, const CT_CBUF_INDEX min_capacity) {
+    const size_t old_capacity = buf->capacity;
+    const size_t new_capacity = page_align_up(min_capacity ? min_capacity : 1, buf->page_size);
+
+    if (new_capacity >= old_capacity)
+        return 0;
+
+    if (ct_cbuf_space_occupied(buf)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (buf->memfd < 0 || buf->journal) {
+        errno = EPERM;
+        return -1;
+    }
+
+    void* addr = map_mirror(buf->memfd, 0, new_capacity, buf->page_size);
+    if (!addr)
+        return -1;
+
+    // Drop the old mappings before cutting off the pages behind them
+    munmap(buf->buffer, old_capacity * 2);
+    ftruncate(buf->memfd, new_capacity);
+
+    buf->buffer = addr;
+    buf->capacity = new_capacity;
+    buf->head = 0;
+    buf->tail = 0;
+
+    return 0;
+}
+
+ssize_t ct_cbuf_read(struct ct_cbuf* buf, void* dst, CT_CBUF_INDEX read_count) {
+    CT_CBUF_INDEX available;
+    const void* src = ct_cbuf_peek(buf, &available);
+
     // Reduce the read count if there is not enough data available
-    if (read_count > ct_cbuf_space_occupied(buf))
-        read_count = ct_cbuf_space_occupied(buf);
+    if (read_count > available)
+        read_count = available;
 
     // Perform the read operation
-    memcpy(dst, buf->buffer + buf->tail, read_count);
+    memcpy(dst, src, read_count);
 
     // Update the tail
+    ct_cbuf_consume(buf, read_count);
+
+    // Return the amount of bytes read
+    return read_count;
+}
+
+ssize_t ct_cbuf_write(struct ct_cbuf* buf, const void* src, const CT_CBUF_INDEX write_count) {
+    CT_CBUF_INDEX available;
+    void* dst = ct_cbuf_write_reserve(buf, &available);
+
+    // Disallow any call to write more bytes than
+    // how much space is currently available in the buffer.
+    if (write_count > available)
+        return -1;
+
+    // Perform the write operation
+    memcpy(dst, src, write_count);
+
+    // Update the head
+    ct_cbuf_write_commit(buf, write_count);
+
+    // Notify success
+    return write_count;
+}
+
+void* ct_cbuf_write_reserve(struct ct_cbuf* buf, CT_CBUF_INDEX* available) {
+    if (available)
+        *available = ct_cbuf_space_left(buf);
+
+    // The mirrored second half guarantees that all free space
+    // is contiguous from the head, even when it wraps around.
+    return buf->buffer + buf->head;
+}
+
+int ct_cbuf_write_commit(struct ct_cbuf* buf, const CT_CBUF_INDEX write_count) {
+    if (write_count > ct_cbuf_space_left(buf))
+        return -1;
+
+    buf->head += write_count;
+
+    return 0;
+}
+
+const void* ct_cbuf_peek(const struct ct_cbuf* buf, CT_CBUF_INDEX* available) {
+    if (available)
+        *available = ct_cbuf_space_occupied(buf);
+
+    // The mirrored second half guarantees that all occupied space
+    // is contiguous from the tail, even when it wraps around.
+    return buf->buffer + buf->tail;
+}
+
+int ct_cbuf_consume(struct ct_cbuf* buf, const CT_CBUF_INDEX read_count) {
+    if (read_count > ct_cbuf_space_occupied(buf))
+        return -1;
+
     buf->tail += read_count;
 
     // When the tail enters the second half of the address space,
@@ -76,30 +505,572 @@ int ct_cbuf_read(struct ct_cbuf* buf, void* dst, unsigned int read_count) {
         buf->tail -= buf->capacity;
     }
 
+    return 0;
+}
+
+ssize_t ct_cbuf_fill_from_fd(struct ct_cbuf* buf, int fd) {
+    CT_CBUF_INDEX available;
+    void* dst = ct_cbuf_write_reserve(buf, &available);
+
+    // A read of zero bytes would be indistinguishable from end-of-file
+    if (available == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t read_count = read(fd, dst, available);
+    if (read_count > 0)
+        ct_cbuf_write_commit(buf, read_count);
+
+    return read_count;
+}
+
+ssize_t ct_cbuf_drain_to_fd(struct ct_cbuf* buf, int fd) {
+    CT_CBUF_INDEX available;
+    const void* src = ct_cbuf_peek(buf, &available);
+
+    if (available == 0)
+        return 0;
+
+    ssize_t write_count = write(fd, src, available);
+    if (write_count > 0)
+        ct_cbuf_consume(buf, write_count);
+
+    return write_count;
+}
+
+/**
+ * Moves up to `length` bytes from a pipe to the head of the buffer, without committing them.
+ */
+static ssize_t splice_to_head(struct ct_cbuf* buf, int pipe_fd, void* dst, loff_t offset, size_t length) {
+    // Buffers handed out by a ct_cbuf_pool have no memfd of their own
+    ssize_t read_count = -1;
+    errno = EINVAL;
+    if (buf->memfd >= 0)
+        read_count = splice(pipe_fd, NULL, buf->memfd, &offset, length, SPLICE_F_MOVE);
+
+    // Huge page memfds cannot be written to, only mapped
+    if (read_count < 0 && errno == EINVAL)
+        read_count = read(pipe_fd, dst, length);
+
+    return read_count;
+}
+
+ssize_t ct_cbuf_splice_in(struct ct_cbuf* buf, int pipe_fd, int tap_fd) {
+    CT_CBUF_INDEX available;
+    void* dst = ct_cbuf_write_reserve(buf, &available);
+
+    if (available == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // The memfd holds the data only once, so the transfer has to stop at the end of it
+    CT_CBUF_INDEX position = buf->head >= buf->capacity ? buf->head - buf->capacity : buf->head;
+    size_t length = available;
+    if (length > buf->capacity - position)
+        length = buf->capacity - position;
+
+    // The data of file-backed buffers follows the header page
+    loff_t offset = buf->journal ? buf->page_size + position : position;
+
+    if (tap_fd < 0) {
+        const ssize_t read_count = splice_to_head(buf, pipe_fd, dst, offset, length);
+        if (read_count > 0)
+            ct_cbuf_write_commit(buf, read_count);
+
+        return read_count;
+    }
+
+    // Duplicate the data first, then move exactly as much as the tap took
+    const ssize_t tee_count = tee(pipe_fd, tap_fd, length, SPLICE_F_NONBLOCK);
+    if (tee_count <= 0)
+        return tee_count;
+
+    // The tap has its copy now. Anything left in the pipe would be teed to the tap again by the next call,
+    // so keep going until all of it is in the buffer. It is in the pipe already, so this does not wait.
+    size_t moved = 0;
+    while (moved < (size_t) tee_count) {
+        const ssize_t read_count = splice_to_head(buf, pipe_fd, (unsigned char*) dst + moved, offset + moved, tee_count - moved);
+        if (read_count < 0 && errno == EINTR)
+            continue;
+
+        // Only possible if someone else reads from the pipe as well
+        if (read_count <= 0)
+            break;
+
+        moved += read_count;
+    }
+
+    if (moved == 0)
+        return -1;
+
+    ct_cbuf_write_commit(buf, moved);
+
+    return moved;
+}
+
+ssize_t ct_cbuf_splice_out(struct ct_cbuf* buf, int pipe_fd) {
+    CT_CBUF_INDEX available;
+    const void* src = ct_cbuf_peek(buf, &available);
+
+    if (available == 0)
+        return 0;
+
+    // The doubled mapping lets a single vector cover the data, even when it wraps around
+    struct iovec iov = { .iov_base = (void*) src, .iov_len = available };
+
+    ssize_t write_count = vmsplice(pipe_fd, &iov, 1, 0);
+    if (write_count > 0)
+        ct_cbuf_consume(buf, write_count);
+
+    return write_count;
+}
+
+CT_CBUF_INDEX ct_cbuf_space_left(const struct ct_cbuf* buf) {
+    return buf->capacity - ct_cbuf_space_occupied(buf);
+}
+
+CT_CBUF_INDEX ct_cbuf_space_occupied(const struct ct_cbuf* buf) {
+    return buf->head - buf->tail;
+}
+
+
+
+/*
+ * Single-producer/single-consumer mode.
+ *
+ * Each side owns one index and is the only one writing to it. The indices run through [0, 2 * capacity),
+ * which keeps a full buffer distinguishable from an empty one without ever moving the other side's index.
+ */
+
+static inline CT_CBUF_INDEX spsc_offset(const struct ct_cbuf_spsc* buf, CT_CBUF_INDEX index) {
+    return index >= buf->capacity ? index - buf->capacity : index;
+}
+
+static inline CT_CBUF_INDEX spsc_advance(const struct ct_cbuf_spsc* buf, CT_CBUF_INDEX index, CT_CBUF_INDEX count) {
+    index += count;
+    return index >= buf->capacity * 2 ? index - buf->capacity * 2 : index;
+}
+
+static inline CT_CBUF_INDEX spsc_distance(const struct ct_cbuf_spsc* buf, CT_CBUF_INDEX head, CT_CBUF_INDEX tail) {
+    return head >= tail ? head - tail : head + buf->capacity * 2 - tail;
+}
+
+int ct_cbuf_spsc_init(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX min_capacity) {
+    return ct_cbuf_spsc_init_ex(buf, min_capacity, 0);
+}
+
+int ct_cbuf_spsc_init_ex(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX min_capacity, const int flags) {
+    // The indices live on their own page in front of the data,
+    // so they never share a cache line with whatever surrounds the struct.
+    struct mirror mirror;
+    if (create_mirror(&mirror, min_capacity, flags, 1))
+        return -1;
+
+    // Describe the layout, for processes attaching to the memfd later
+    struct ct_cbuf_spsc_control* control = mirror.header;
+    control->index_size = sizeof(CT_CBUF_INDEX);
+    control->capacity = mirror.capacity;
+    control->page_size = mirror.page_size;
+    control->magic = SPSC_MAGIC;
+
+    *buf = (struct ct_cbuf_spsc) {
+        .buffer = mirror.buffer,
+        .memfd = mirror.fd,
+        .capacity = mirror.capacity,
+        .control = mirror.header,
+        .page_size = mirror.page_size,
+        .eventfd = -1,
+    };
+
+    return 0;
+}
+
+void ct_cbuf_spsc_exit(struct ct_cbuf_spsc* buf) {
+    munmap(buf->buffer, (size_t) buf->capacity * 2);
+    munmap(buf->control, buf->page_size);
+    close(buf->memfd);
+
+    if (buf->eventfd >= 0)
+        close(buf->eventfd);
+
+    // Zero out the struct
+    memset(buf, 0, sizeof(struct ct_cbuf_spsc));
+}
+
+int ct_cbuf_spsc_export(const struct ct_cbuf_spsc* buf, int sock) {
+    char control_data[CMSG_SPACE(sizeof(int))];
+    memset(control_data, 0, sizeof(control_data));
+
+    // At least one byte of real data has to accompany the file descriptor
+    char data = 0;
+    struct iovec iov = { .iov_base = &data, .iov_len = 1 };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control_data,
+        .msg_controllen = sizeof(control_data),
+    };
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &buf->memfd, sizeof(int));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+int ct_cbuf_spsc_attach(struct ct_cbuf_spsc* buf, int sock) {
+    char control_data[CMSG_SPACE(sizeof(int))];
+    char data;
+    struct iovec iov = { .iov_base = &data, .iov_len = 1 };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control_data,
+        .msg_controllen = sizeof(control_data),
+    };
+
+    ssize_t res = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (res < 0)
+        return -1;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (res == 0 || !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    return ct_cbuf_spsc_attach_fd(buf, fd);
+}
+
+int ct_cbuf_spsc_attach_fd(struct ct_cbuf_spsc* buf, int fd) {
+    // The block size of a memfd is the size of its pages, huge or not
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    const size_t page_size = st.st_blksize;
+
+    struct ct_cbuf_spsc_control* control = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (control == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    // Make sure the memfd holds a buffer with the layout this process expects
+    if (control->magic != SPSC_MAGIC ||
+        control->index_size != sizeof(CT_CBUF_INDEX) ||
+        control->page_size != page_size ||
+        (uint64_t) st.st_size != page_size + control->capacity) {
+        munmap(control, page_size);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* addr = map_mirror(fd, page_size, control->capacity, page_size);
+    if (!addr) {
+        const int error = errno;
+        munmap(control, page_size);
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    *buf = (struct ct_cbuf_spsc) {
+        .buffer = addr,
+        .memfd = fd,
+        .capacity = control->capacity,
+        .control = control,
+        .page_size = page_size,
+        .eventfd = -1,
+    };
+
+    return 0;
+}
+
+/**
+ * Wakes up the other side, if it sleeps in spsc_wait(). Called right after `self` has moved its index.
+ *
+ * The full fence pairs with the one in spsc_wait(), so that either the waiter sees the moved index,
+ * or this side sees the waiter's `sleeping` flag. Without it, both could miss each other and the waiter would sleep on.
+ */
+static inline void spsc_notify(struct ct_cbuf_spsc_index* self, struct ct_cbuf_spsc_index* other) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&other->sleeping, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&self->wake, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &self->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+void* ct_cbuf_spsc_write_reserve(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX min_count, CT_CBUF_INDEX* available) {
+    struct ct_cbuf_spsc_index* producer = &buf->control->producer;
+    const CT_CBUF_INDEX head = producer->value;
+
+    // Only look at the consumer's index when the cached copy says there is not enough space
+    CT_CBUF_INDEX space = buf->capacity - spsc_distance(buf, head, producer->cached);
+    if (space < min_count || space == 0) {
+        producer->cached = __atomic_load_n(&buf->control->consumer.value, __ATOMIC_ACQUIRE);
+        space = buf->capacity - spsc_distance(buf, head, producer->cached);
+    }
+
+    if (available)
+        *available = space;
+
+    if (space < min_count)
+        return NULL;
+
+    return buf->buffer + spsc_offset(buf, head);
+}
+
+int ct_cbuf_spsc_write_commit(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX write_count) {
+    struct ct_cbuf_spsc_index* producer = &buf->control->producer;
+
+    if (!ct_cbuf_spsc_write_reserve(buf, write_count, NULL))
+        return -1;
+
+    // Publish the written bytes to the consumer
+    const CT_CBUF_INDEX head = producer->value;
+    __atomic_store_n(&producer->value, spsc_advance(buf, head, write_count), __ATOMIC_RELEASE);
+
+    spsc_notify(producer, &buf->control->consumer);
+
+    // Only the transition from empty to non-empty is signalled, see ct_cbuf_spsc_eventfd()
+    if (write_count && buf->eventfd >= 0 && __atomic_load_n(&buf->control->consumer.value, __ATOMIC_RELAXED) == head) {
+        const uint64_t one = 1;
+        write(buf->eventfd, &one, sizeof(one));
+    }
+
+    return 0;
+}
+
+const void* ct_cbuf_spsc_peek(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX min_count, CT_CBUF_INDEX* available) {
+    struct ct_cbuf_spsc_index* consumer = &buf->control->consumer;
+    const CT_CBUF_INDEX tail = consumer->value;
+
+    // Only look at the producer's index when the cached copy says there is not enough data
+    CT_CBUF_INDEX occupied = spsc_distance(buf, consumer->cached, tail);
+    if (occupied < min_count || occupied == 0) {
+        consumer->cached = __atomic_load_n(&buf->control->producer.value, __ATOMIC_ACQUIRE);
+        occupied = spsc_distance(buf, consumer->cached, tail);
+    }
+
+    if (available)
+        *available = occupied;
+
+    if (occupied < min_count)
+        return NULL;
+
+    return buf->buffer + spsc_offset(buf, tail);
+}
+
+int ct_cbuf_spsc_consume(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX read_count) {
+    struct ct_cbuf_spsc_index* consumer = &buf->control->consumer;
+
+    if (!ct_cbuf_spsc_peek(buf, read_count, NULL))
+        return -1;
+
+    // Hand the released space back to the producer
+    __atomic_store_n(&consumer->value, spsc_advance(buf, consumer->value, read_count), __ATOMIC_RELEASE);
+
+    spsc_notify(consumer, &buf->control->producer);
+
+    return 0;
+}
+
+static inline void spsc_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline int spsc_ready(struct ct_cbuf_spsc* buf, const int readable, const CT_CBUF_INDEX min_count) {
+    if (readable)
+        return ct_cbuf_spsc_peek(buf, min_count, NULL) != NULL;
+
+    return ct_cbuf_spsc_write_reserve(buf, min_count, NULL) != NULL;
+}
+
+static inline int64_t monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Waits until the consumer (`readable`) or the producer (not `readable`) has `min_count` bytes to work with.
+ */
+static int spsc_wait(struct ct_cbuf_spsc* buf, const int readable, const CT_CBUF_INDEX min_count, const int timeout_ms) {
+    struct ct_cbuf_spsc_index* self = readable ? &buf->control->consumer : &buf->control->producer;
+    struct ct_cbuf_spsc_index* other = readable ? &buf->control->producer : &buf->control->consumer;
+
+    if (min_count > buf->capacity) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Under load, the other side catches up within a few hundred cycles, which is much cheaper than a syscall
+    for (int i = 0; i < SPSC_SPIN_COUNT; i++) {
+        if (spsc_ready(buf, readable, min_count))
+            return 0;
+
+        if (timeout_ms == 0)
+            break;
+
+        spsc_cpu_relax();
+    }
+
+    const int64_t deadline = timeout_ms > 0 ? monotonic_ms() + timeout_ms : 0;
+
+    for (;;) {
+        __atomic_store_n(&self->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        // Read the futex word before looking at the index. A wake-up in between changes the word,
+        // which makes the futex call return right away instead of sleeping.
+        const uint32_t wake = __atomic_load_n(&other->wake, __ATOMIC_ACQUIRE);
+
+        if (spsc_ready(buf, readable, min_count))
+            break;
+
+        struct timespec timeout;
+        if (timeout_ms >= 0) {
+            const int64_t remaining = timeout_ms == 0 ? 0 : deadline - monotonic_ms();
+
+            if (remaining <= 0) {
+                __atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+                errno = ETIMEDOUT;
+                return -1;
+            }
+
+            timeout.tv_sec = remaining / 1000;
+            timeout.tv_nsec = (remaining % 1000) * 1000000;
+        }
+
+        // Not private, since the other side may live in another process.
+        // Spurious wake-ups, EINTR, EAGAIN and ETIMEDOUT all lead back to the check above.
+        syscall(SYS_futex, &other->wake, FUTEX_WAIT, wake, timeout_ms >= 0 ? &timeout : NULL, NULL, 0);
+    }
+
+    __atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+int ct_cbuf_spsc_wait_readable(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX min_count, int timeout_ms) {
+    return spsc_wait(buf, 1, min_count, timeout_ms);
+}
+
+int ct_cbuf_spsc_wait_writable(struct ct_cbuf_spsc* buf, const CT_CBUF_INDEX min_count, int timeout_ms) {
+    return spsc_wait(buf, 0, min_count, timeout_ms);
+}
+
+int ct_cbuf_spsc_eventfd(struct ct_cbuf_spsc* buf) {
+    if (buf->eventfd >= 0)
+        return buf->eventfd;
+
+    buf->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    // Data that arrived before the eventfd existed would never be signalled
+    if (buf->eventfd >= 0 && ct_cbuf_spsc_space_occupied(buf) > 0) {
+        const uint64_t one = 1;
+        write(buf->eventfd, &one, sizeof(one));
+    }
+
+    return buf->eventfd;
+}
+
+ssize_t ct_cbuf_spsc_read(struct ct_cbuf_spsc* buf, void* dst, CT_CBUF_INDEX read_count) {
+    CT_CBUF_INDEX available;
+    ct_cbuf_spsc_peek(buf, read_count, &available);
+
+    // Reduce the read count if there is not enough data available
+    if (read_count > available)
+        read_count = available;
+
+    // Perform the read operation
+    memcpy(dst, buf->buffer + spsc_offset(buf, buf->control->consumer.value), read_count);
+
+    // Update the tail
+    ct_cbuf_spsc_consume(buf, read_count);
+
     // Return the amount of bytes read
     return read_count;
 }
 
-int ct_cbuf_write(struct ct_cbuf* buf, const void* src, const unsigned int write_count) {
+ssize_t ct_cbuf_spsc_write(struct ct_cbuf_spsc* buf, const void* src, const CT_CBUF_INDEX write_count) {
+    void* dst = ct_cbuf_spsc_write_reserve(buf, write_count, NULL);
+
     // Disallow any call to write more bytes than
     // how much space is currently available in the buffer.
-    if (write_count > ct_cbuf_space_left(buf))
+    if (!dst)
         return -1;
 
     // Perform the write operation
-    memcpy(buf->buffer + buf->head, src, write_count);
+    memcpy(dst, src, write_count);
 
     // Update the head
-    buf->head += write_count;
+    ct_cbuf_spsc_write_commit(buf, write_count);
 
     // Notify success
     return write_count;
 }
 
-unsigned int ct_cbuf_space_left(const struct ct_cbuf* buf) {
-    return buf->capacity - ct_cbuf_space_occupied(buf);
+ssize_t ct_cbuf_spsc_fill_from_fd(struct ct_cbuf_spsc* buf, int fd) {
+    CT_CBUF_INDEX available;
+
+    // Ask for the whole capacity to make sure the cached tail is refreshed,
+    // since a syscall is far more expensive than looking at the consumer's index.
+    ct_cbuf_spsc_write_reserve(buf, buf->capacity, &available);
+
+    if (available == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t read_count = read(fd, buf->buffer + spsc_offset(buf, buf->control->producer.value), available);
+    if (read_count > 0)
+        ct_cbuf_spsc_write_commit(buf, read_count);
+
+    return read_count;
 }
 
-unsigned int ct_cbuf_space_occupied(const struct ct_cbuf* buf) {
-    return buf->head - buf->tail;
+ssize_t ct_cbuf_spsc_drain_to_fd(struct ct_cbuf_spsc* buf, int fd) {
+    CT_CBUF_INDEX available;
+
+    // Ask for the whole capacity to make sure the cached head is refreshed
+    ct_cbuf_spsc_peek(buf, buf->capacity, &available);
+
+    if (available == 0)
+        return 0;
+
+    ssize_t write_count = write(fd, buf->buffer + spsc_offset(buf, buf->control->consumer.value), available);
+    if (write_count > 0)
+        ct_cbuf_spsc_consume(buf, write_count);
+
+    return write_count;
+}
+
+CT_CBUF_INDEX ct_cbuf_spsc_space_left(const struct ct_cbuf_spsc* buf) {
+    return buf->capacity - ct_cbuf_spsc_space_occupied(buf);
+}
+
+CT_CBUF_INDEX ct_cbuf_spsc_space_occupied(const struct ct_cbuf_spsc* buf) {
+    const CT_CBUF_INDEX tail = __atomic_load_n(&buf->control->consumer.value, __ATOMIC_ACQUIRE);
+    const CT_CBUF_INDEX head = __atomic_load_n(&buf->control->producer.value, __ATOMIC_ACQUIRE);
+
+    return spsc_distance(buf, head, tail);
 }
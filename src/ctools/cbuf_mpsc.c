@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include "ctools/cbuf_mpsc.h"
+
+/**
+ * The header in front of every payload. Frames are aligned to the size of the header,
+ * so a header is never split by the end of the first half of the address space.
+ */
+struct frame {
+    uint32_t length;
+    uint32_t committed;
+};
+
+static inline CT_CBUF_INDEX frame_size(const uint32_t length) {
+    return (sizeof(struct frame) + length + sizeof(struct frame) - 1) & ~(CT_CBUF_INDEX)(sizeof(struct frame) - 1);
+}
+
+static inline struct frame* frame_at(const struct ct_cbuf_mpsc* buf, const CT_CBUF_INDEX index) {
+    return buf->ring.buffer + (index & (buf->ring.capacity - 1));
+}
+
+int ct_cbuf_mpsc_init(struct ct_cbuf_mpsc* buf, const CT_CBUF_INDEX min_capacity) {
+    // Round the capacity up to a power of two, so the free running indices stay valid when they overflow
+    CT_CBUF_INDEX capacity = 1;
+    while (capacity < min_capacity) {
+        if (capacity > ((CT_CBUF_INDEX) -1) / 4)
+            return -1;
+
+        capacity <<= 1;
+    }
+
+    // A power of two at least as large as the page size is page-aligned
+    if (ct_cbuf_init(&buf->ring, capacity))
+        return -1;
+
+    // The page size is a power of two as well
+    if (buf->ring.capacity & (buf->ring.capacity - 1)) {
+        ct_cbuf_exit(&buf->ring);
+        return -1;
+    }
+
+    // The memfd starts out zeroed, meaning that no frame looks committed
+    buf->head = 0;
+    buf->tail = 0;
+
+    return 0;
+}
+
+void ct_cbuf_mpsc_exit(struct ct_cbuf_mpsc* buf) {
+    ct_cbuf_exit(&buf->ring);
+
+    buf->head = 0;
+    buf->tail = 0;
+}
+
+void* ct_cbuf_mpsc_reserve(struct ct_cbuf_mpsc* buf, const uint32_t length) {
+    // Reject oversized frames before rounding, which would wrap around for lengths close to UINT32_MAX
+    if (length > buf->ring.capacity - sizeof(struct frame))
+        return NULL;
+
+    const CT_CBUF_INDEX size = frame_size(length);
+
+    // A fetch-and-add could not be undone when the buffer is full, so claim the frame with a compare-and-swap
+    CT_CBUF_INDEX head;
+    do {
+        // Reading the tail first keeps it from overtaking the head we compare it with.
+        // Acquiring it also makes the consumer's zeroing of released frames visible.
+        const CT_CBUF_INDEX tail = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&buf->head, __ATOMIC_RELAXED);
+
+        if (head - tail > buf->ring.capacity - size)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(&buf->head, &head, head + size, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    struct frame* frame = frame_at(buf, head);
+    frame->length = length;
+
+    return frame + 1;
+}
+
+void ct_cbuf_mpsc_commit(struct ct_cbuf_mpsc* buf, void* payload) {
+    (void) buf;
+
+    struct frame* frame = (struct frame*) payload - 1;
+
+    // Publish the length and the payload along with the flag
+    __atomic_store_n(&frame->committed, 1, __ATOMIC_RELEASE);
+}
+
+int ct_cbuf_mpsc_write(struct ct_cbuf_mpsc* buf, const void* payload, const uint32_t length) {
+    void* dst = ct_cbuf_mpsc_reserve(buf, length);
+    if (!dst)
+        return -1;
+
+    memcpy(dst, payload, length);
+    ct_cbuf_mpsc_commit(buf, dst);
+
+    return 0;
+}
+
+unsigned int ct_cbuf_mpsc_read(struct ct_cbuf_mpsc* buf, ct_cbuf_mpsc_handler handler, void* context, const unsigned int max_frames) {
+    const CT_CBUF_INDEX start = buf->tail;
+    CT_CBUF_INDEX tail = start;
+    unsigned int count = 0;
+
+    // When the buffer is full, the frame after the last one is the first one again,
+    // and it still reads as committed until the batch is zeroed. So never go past the head.
+    const CT_CBUF_INDEX head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+
+    // Stop at the first frame that is not committed, to keep the frames in order
+    for (; count < max_frames && tail != head; count++) {
+        const struct frame* frame = frame_at(buf, tail);
+
+        if (!__atomic_load_n(&frame->committed, __ATOMIC_ACQUIRE))
+            break;
+
+        handler(context, frame + 1, frame->length);
+
+        tail += frame_size(frame->length);
+    }
+
+    if (tail != start) {
+        // Zero the whole batch before releasing it. Any header that a producer
+        // reserves later must read as uncommitted until the producer commits it.
+        memset(frame_at(buf, start), 0, tail - start);
+
+        __atomic_store_n(&buf->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return count;
+}
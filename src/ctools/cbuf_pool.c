@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ctools/cbuf_pool.h"
+#include "ctools/alloc.h"
+
+static inline void* slot_address(const struct ct_cbuf_pool* pool, const unsigned int index) {
+    return pool->reservation + (size_t) index * pool->capacity * 2;
+}
+
+int ct_cbuf_pool_init(struct ct_cbuf_pool* pool, const unsigned int count, const CT_CBUF_INDEX min_capacity, const int flags) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t capacity = ((min_capacity ? min_capacity : 1) + page_size - 1) & ~(page_size - 1);
+
+    // Both indices must be able to address the doubled address space, and all slots must fit into one reservation
+    if (count == 0 || capacity > ((CT_CBUF_INDEX) -1) / 2 || capacity > SIZE_MAX / 2 / count) {
+        errno = count == 0 ? EINVAL : EOVERFLOW;
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(struct ct_cbuf_pool));
+    pool->memfd = -1;
+    pool->capacity = capacity;
+    pool->count = count;
+    pool->flags = flags;
+    pool->reservation_size = capacity * 2 * count;
+
+    pool->cbufs = (struct ct_cbuf*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, count * sizeof(struct ct_cbuf));
+    pool->free = (unsigned int*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, count * sizeof(unsigned int));
+    if (!pool->cbufs || !pool->free) {
+        // The hooks are not required to set errno
+        errno = ENOMEM;
+        goto error;
+    }
+
+    memset(pool->cbufs, 0, count * sizeof(struct ct_cbuf));
+
+    // One memfd holds the data of all buffers, back to back
+    pool->memfd = memfd_create("mirror-pool", 0);
+    if (pool->memfd < 0 || ftruncate(pool->memfd, capacity * count))
+        goto error;
+
+    // Reserve address space for all doubled slots at once
+    pool->reservation = mmap(NULL, pool->reservation_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pool->reservation == MAP_FAILED) {
+        pool->reservation = NULL;
+        goto error;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        void* slot = slot_address(pool, i);
+        const off_t offset = (off_t) i * capacity;
+
+        // Map the buffer's part of the memfd twice in a row, replacing the reserved range
+        if (mmap(slot, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pool->memfd, offset) == MAP_FAILED ||
+            mmap(slot + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pool->memfd, offset) == MAP_FAILED)
+            goto error;
+
+        // Hand out the lowest slots first
+        pool->free[count - 1 - i] = i;
+    }
+
+    pool->free_count = count;
+
+    return 0;
+
+error:;
+    const int error = errno;
+    ct_cbuf_pool_exit(pool);
+    errno = error;
+    return -1;
+}
+
+void ct_cbuf_pool_exit(struct ct_cbuf_pool* pool) {
+    if (pool->reservation)
+        munmap(pool->reservation, pool->reservation_size);
+    if (pool->memfd >= 0)
+        close(pool->memfd);
+
+    if (pool->cbufs)
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, pool->cbufs, pool->count * sizeof(struct ct_cbuf));
+    if (pool->free)
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, pool->free, pool->count * sizeof(unsigned int));
+
+    // Zero out the struct
+    memset(pool, 0, sizeof(struct ct_cbuf_pool));
+    pool->memfd = -1;
+}
+
+struct ct_cbuf* ct_cbuf_pool_acquire(struct ct_cbuf_pool* pool) {
+    if (pool->free_count == 0)
+        return NULL;
+
+    const unsigned int index = pool->free[--pool->free_count];
+
+    const unsigned int in_use = pool->count - pool->free_count;
+    if (in_use > pool->high_water)
+        pool->high_water = in_use;
+
+    struct ct_cbuf* cbuf = &pool->cbufs[index];
+    *cbuf = (struct ct_cbuf) {
+        .buffer = slot_address(pool, index),
+        .memfd = -1,
+        .capacity = pool->capacity,
+        .head = 0,
+        .tail = 0,
+        .page_size = sysconf(_SC_PAGESIZE),
+    };
+
+    return cbuf;
+}
+
+int ct_cbuf_pool_release(struct ct_cbuf_pool* pool, struct ct_cbuf* cbuf) {
+    const ptrdiff_t index = cbuf - pool->cbufs;
+
+    // Reject foreign and already released buffers
+    if (index < 0 || index >= pool->count || !cbuf->buffer)
+        return -1;
+
+    if (pool->flags & CT_CBUF_POOL_DISCARD) {
+        // Frees the pages behind both halves, which read as zeroes afterwards
+        madvise(cbuf->buffer, pool->capacity, MADV_REMOVE);
+    } else if (pool->flags & CT_CBUF_POOL_ZERO) {
+        memset(cbuf->buffer, 0, pool->capacity);
+    }
+
+    // Make any later use of a stale pointer to the buffer fail loudly
+    memset(cbuf, 0, sizeof(struct ct_cbuf));
+
+    pool->free[pool->free_count++] = index;
+
+    return 0;
+}
+
+void ct_cbuf_pool_stats(const struct ct_cbuf_pool* pool, struct ct_cbuf_pool_stats* stats) {
+    *stats = (struct ct_cbuf_pool_stats) {
+        .count = pool->count,
+        .in_use = pool->count - pool->free_count,
+        .high_water = pool->high_water,
+    };
+}
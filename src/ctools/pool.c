@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ctools/pool.h"
+#include "ctools/alloc.h"
+
+struct ct_pool_task {
+    ct_pool_fn fn;
+    void* arg;
+
+    // CLOCK_MONOTONIC, in nanoseconds. Only used by delayed tasks.
+    uint64_t deadline;
+};
+
+#define DEQUE_NAME ct_pool_deque
+#define DEQUE_TYPE struct ct_pool_task*
+#include "ctools/deque.h"
+
+#define QUEUE_NAME ct_pool_queue
+#define QUEUE_TYPE struct ct_pool_task*
+#define QUEUE_EXT_GROWABLE
+#include "ctools/queue.h"
+
+// The earliest deadline at the root
+#define HEAP_NAME ct_pool_timers
+#define HEAP_TYPE struct ct_pool_task*
+#define HEAP_COMP(a,b) ((a)->deadline < (b)->deadline ? -1 : (a)->deadline > (b)->deadline)
+#include "ctools/heap.h"
+
+#define NO_DEADLINE UINT64_MAX
+
+// How often a worker looks at the shared queues before its own deque
+#define SHARED_INTERVAL 64
+
+struct ct_pool_worker {
+    ct_pool_deque tasks;
+
+    struct ct_pool* pool;
+    pthread_t thread;
+
+    // Picks the first worker to steal from
+    uint32_t seed;
+
+    // Counts the calls to next_task()
+    uint32_t ticks;
+};
+
+// The worker running on the current thread, if any
+static __thread struct ct_pool_worker* current_worker;
+
+// The allocator hooks do not promise any alignment, so the workers are aligned within a slightly larger block
+static size_t worker_block_size(const unsigned int worker_count) {
+    return worker_count * sizeof(struct ct_pool_worker) + __alignof__(struct ct_pool_worker) - 1;
+}
+
+static void task_destroy(struct ct_pool_task* task) {
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, task, sizeof(struct ct_pool_task));
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Appends a task to the injection queue, which doubles when it is full. Called with the lock held.
+ */
+static int inject(struct ct_pool* pool, struct ct_pool_task* task) {
+    return ct_pool_queue_push(pool->injected, task);
+}
+
+/**
+ * Moves every delayed task that is due to the injection queue. Called with the lock held.
+ */
+static void release_timers(struct ct_pool* pool, const uint64_t now) {
+    while (ct_pool_timers_size(pool->timers)) {
+        struct ct_pool_task* task = ct_pool_timers_peek(pool->timers);
+
+        // If the injection queue cannot grow, the task stays put and is tried again later
+        if (task->deadline > now || inject(pool, task))
+            break;
+
+        ct_pool_timers_pop(pool->timers, &task);
+    }
+
+    const uint64_t next_deadline = ct_pool_timers_size(pool->timers) ? ct_pool_timers_peek(pool->timers)->deadline : NO_DEADLINE;
+    __atomic_store_n(&pool->next_deadline, next_deadline, __ATOMIC_RELAXED);
+}
+
+/**
+ * Whether any task is ready to run on some worker. Called with the lock held.
+ */
+static bool has_work(struct ct_pool* pool) {
+    if (!ct_pool_queue_is_empty(pool->injected))
+        return true;
+
+    for (unsigned int i = 0; i < pool->worker_count; i++)
+        if (ct_pool_deque_size(&pool->workers[i].tasks))
+            return true;
+
+    return false;
+}
+
+static struct ct_pool_task* steal(struct ct_pool_worker* worker) {
+    struct ct_pool* pool = worker->pool;
+    struct ct_pool_task* task;
+
+    // Start at a random victim, so the thieves spread out
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+
+    bool contended;
+    do {
+        contended = false;
+
+        for (unsigned int i = 0; i < pool->worker_count; i++) {
+            struct ct_pool_worker* victim = &pool->workers[(worker->seed + i) % pool->worker_count];
+            if (victim == worker)
+                continue;
+
+            const int res = ct_pool_deque_steal(&victim->tasks, &task);
+            if (res == 0)
+                return task;
+
+            // Another thief was faster, but there may be more to take
+            contended |= res == -4;
+        }
+    } while (contended);
+
+    return NULL;
+}
+
+/**
+ * Finds the next task for a worker, and sleeps until there is one.
+ * Returns NULL once the pool is shutting down and no tasks are left.
+ */
+static struct ct_pool_task* next_task(struct ct_pool_worker* worker) {
+    struct ct_pool* pool = worker->pool;
+    struct ct_pool_task* task;
+
+    while (1) {
+        // Tasks spawned by the tasks of this worker come first. Now and then the shared queues go first,
+        // so that a worker busy with its own tasks does not starve the injection queue and the timers.
+        const bool shared_first = ++worker->ticks % SHARED_INTERVAL == 0;
+
+        if (!shared_first && !ct_pool_deque_pop(&worker->tasks, &task))
+            return task;
+
+        const uint64_t next_deadline = __atomic_load_n(&pool->next_deadline, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (next_deadline != NO_DEADLINE && !pool->shutting_down)
+            release_timers(pool, now_ns());
+
+        const int res = ct_pool_queue_pop(pool->injected, &task);
+
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!res)
+            return task;
+
+        if (shared_first && !ct_pool_deque_pop(&worker->tasks, &task))
+            return task;
+
+        if ((task = steal(worker)))
+            return task;
+
+        // Go to sleep, unless a task showed up in the meantime
+        pthread_mutex_lock(&pool->lock);
+
+        // Submissions to the deques do not take the lock. A submitting worker either sees this worker as sleeping,
+        // and wakes it up, or has pushed its task before the check below.
+        __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (!has_work(pool)) {
+            if (pool->shutting_down) {
+                __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&pool->lock);
+                return NULL;
+            }
+
+            if (ct_pool_timers_size(pool->timers)) {
+                // Wake up in time for the earliest delayed task
+                const uint64_t deadline = ct_pool_timers_peek(pool->timers)->deadline;
+                const struct timespec abs_timeout = {
+                    .tv_sec = deadline / 1000000000,
+                    .tv_nsec = deadline % 1000000000,
+                };
+
+                pthread_cond_timedwait(&pool->wake, &pool->lock, &abs_timeout);
+            } else {
+                pthread_cond_wait(&pool->wake, &pool->lock);
+            }
+        }
+
+        __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void* worker_main(void* arg) {
+    struct ct_pool_worker* worker = (struct ct_pool_worker*) arg;
+    struct ct_pool_task* task;
+
+    current_worker = worker;
+
+    while ((task = next_task(worker))) {
+        task->fn(task->arg);
+        task_destroy(task);
+
+        __atomic_sub_fetch(&worker->pool->pending, 1, __ATOMIC_RELEASE);
+    }
+
+    current_worker = NULL;
+
+    return NULL;
+}
+
+int ct_pool_init(struct ct_pool* pool, unsigned int worker_count) {
+    if (worker_count == 0) {
+        const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpu_count > 0 ? cpu_count : 1;
+    }
+
+    memset(pool, 0, sizeof(struct ct_pool));
+    pool->next_deadline = NO_DEADLINE;
+
+    // Measure the deadlines of delayed tasks on a clock that does not jump
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    unsigned int created = 0;
+
+    // Keep the deques of different workers on separate cache lines
+    pool->worker_block = CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, worker_block_size(worker_count));
+    pool->workers = (struct ct_pool_worker*) (((uintptr_t) pool->worker_block + __alignof__(struct ct_pool_worker) - 1)
+                                              & ~(uintptr_t) (__alignof__(struct ct_pool_worker) - 1));
+    pool->injected = ct_pool_queue_create(64);
+    pool->timers = ct_pool_timers_create(16);
+
+    if (!pool->worker_block || !pool->injected || !pool->timers) {
+        errno = ENOMEM;
+        goto error;
+    }
+
+    for (; created < worker_count; created++) {
+        struct ct_pool_worker* worker = &pool->workers[created];
+
+        worker->pool = pool;
+        worker->seed = 2654435761u * (created + 1);
+        worker->ticks = 0;
+
+        if (ct_pool_deque_create(&worker->tasks, 0)) {
+            errno = ENOMEM;
+            goto error;
+        }
+    }
+
+    // Every worker looks at every deque, so the workers are only started once all of the deques exist
+    pool->worker_count = worker_count;
+
+    unsigned int started = 0;
+    for (; started < worker_count; started++) {
+        const int res = pthread_create(&pool->workers[started].thread, NULL, worker_main, &pool->workers[started]);
+
+        if (res) {
+            errno = res;
+            break;
+        }
+    }
+
+    if (started < worker_count) {
+        const int error = errno;
+
+        // There are no tasks yet, so the workers that did start exit right away
+        ct_pool_shutdown(pool);
+        for (unsigned int i = 0; i < started; i++)
+            pthread_join(pool->workers[i].thread, NULL);
+
+        errno = error;
+        goto error;
+    }
+
+    return 0;
+
+error:;
+    const int error = errno;
+
+    for (unsigned int i = 0; i < created; i++)
+        ct_pool_deque_destroy(&pool->workers[i].tasks);
+
+    if (pool->injected)
+        ct_pool_queue_destroy(pool->injected);
+    if (pool->timers)
+        ct_pool_timers_destroy(pool->timers);
+
+    if (pool->worker_block)
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, pool->worker_block, worker_block_size(worker_count));
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+
+    memset(pool, 0, sizeof(struct ct_pool));
+    errno = error;
+    return -1;
+}
+
+void ct_pool_exit(struct ct_pool* pool) {
+    ct_pool_shutdown(pool);
+
+    for (unsigned int i = 0; i < pool->worker_count; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    // Every queued task has run, apart from the delayed tasks that were not due yet
+    while (ct_pool_timers_size(pool->timers)) {
+        struct ct_pool_task* task;
+        ct_pool_timers_pop(pool->timers, &task);
+        task_destroy(task);
+    }
+
+    for (unsigned int i = 0; i < pool->worker_count; i++)
+        ct_pool_deque_destroy(&pool->workers[i].tasks);
+
+    ct_pool_queue_destroy(pool->injected);
+    ct_pool_timers_destroy(pool->timers);
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, pool->worker_block, worker_block_size(pool->worker_count));
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+
+    // Zero out the struct
+    memset(pool, 0, sizeof(struct ct_pool));
+}
+
+static struct ct_pool_task* task_create(ct_pool_fn fn, void* arg) {
+    struct ct_pool_task* task = (struct ct_pool_task*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(struct ct_pool_task));
+
+    if (!task) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    task->fn = fn;
+    task->arg = arg;
+    task->deadline = 0;
+
+    return task;
+}
+
+int ct_pool_submit(struct ct_pool* pool, ct_pool_fn fn, void* arg) {
+    struct ct_pool_task* task = task_create(fn, arg);
+    if (!task)
+        return -1;
+
+    struct ct_pool_worker* worker = current_worker;
+
+    // A task spawned by a task goes to the deque of its worker, without taking the lock
+    if (worker && worker->pool == pool) {
+        if (__atomic_load_n(&pool->shutting_down, __ATOMIC_ACQUIRE)) {
+            task_destroy(task);
+            errno = ECANCELED;
+            return -1;
+        }
+
+        // Count the task before a thief can run it
+        __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+        if (ct_pool_deque_push(&worker->tasks, task)) {
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+            task_destroy(task);
+            errno = ENOMEM;
+            return -1;
+        }
+
+        // Pairs with the fence of a worker going to sleep, see next_task()
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&pool->sleeping, __ATOMIC_RELAXED)) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->wake);
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->shutting_down || inject(pool, task)) {
+        errno = pool->shutting_down ? ECANCELED : ENOMEM;
+        pthread_mutex_unlock(&pool->lock);
+        task_destroy(task);
+        return -1;
+    }
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+    if (pool->sleeping)
+        pthread_cond_signal(&pool->wake);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+int ct_pool_submit_delayed(struct ct_pool* pool, ct_pool_fn fn, void* arg, const unsigned int delay_ms) {
+    struct ct_pool_task* task = task_create(fn, arg);
+    if (!task)
+        return -1;
+
+    task->deadline = now_ns() + (uint64_t) delay_ms * 1000000;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->shutting_down || ct_pool_timers_push(pool->timers, task)) {
+        errno = pool->shutting_down ? ECANCELED : ENOMEM;
+        pthread_mutex_unlock(&pool->lock);
+        task_destroy(task);
+        return -1;
+    }
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+
+    // A sleeping worker has to wake up earlier than it planned to
+    if (task->deadline < pool->next_deadline) {
+        __atomic_store_n(&pool->next_deadline, task->deadline, __ATOMIC_RELAXED);
+
+        if (pool->sleeping)
+            pthread_cond_signal(&pool->wake);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void ct_pool_shutdown(struct ct_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+
+    // Delayed tasks that are already due may not have been noticed yet, by workers busy with other tasks.
+    // They are queued like the rest, before the workers stop looking at the timers.
+    if (!pool->shutting_down)
+        release_timers(pool, now_ns());
+
+    __atomic_store_n(&pool->shutting_down, true, __ATOMIC_RELEASE);
+
+    // Wake up every sleeping worker, so it can finish the remaining tasks and exit
+    pthread_cond_broadcast(&pool->wake);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+uint64_t ct_pool_pending(struct ct_pool* pool) {
+    return __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE);
+}
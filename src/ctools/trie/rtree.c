@@ -1,4 +1,5 @@
 #include "ctools/trie/rtree.h"
+#include "ctools/alloc.h"
 
 #define STACK_NAME stack
 #define STACK_TYPE uint16_t
@@ -58,7 +59,9 @@ unsigned int rtree_find_required_size(const struct trie_node* top_node) {
 
 struct rtree_node* rtree_create_from_trie(const struct trie_node* top_node) {
     unsigned int required_size = rtree_find_required_size(top_node);
-    struct rtree_node* radix_tree = malloc(required_size * sizeof(struct rtree_node));
+    struct rtree_node* radix_tree = (struct rtree_node*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, required_size * sizeof(struct rtree_node));
+    if (!radix_tree)
+        return NULL;
 
     uint16_t next_index = 0;
     serialize_node(top_node, radix_tree, &next_index);
@@ -70,7 +73,7 @@ struct rtree_node* rtree_create(const struct rtree_setup_entry* entries, const u
     struct trie_node* trie = trie_create();
 
     // Copy the values to a temporary store to prevent modification.
-    uint16_t* temp_value_store = (uint16_t*) malloc(entry_count * sizeof(uint16_t));
+    uint16_t* temp_value_store = (uint16_t*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, entry_count * sizeof(uint16_t));
     for (int i = 0; i < entry_count; i++)
         temp_value_store[i] = entries[i].value;
 
@@ -79,14 +82,15 @@ struct rtree_node* rtree_create(const struct rtree_setup_entry* entries, const u
 
     struct rtree_node* radix_tree = rtree_create_from_trie(trie);
 
-    free(temp_value_store);
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, temp_value_store, entry_count * sizeof(uint16_t));
     trie_destroy(trie);
 
     return radix_tree;
 }
 
 void rtree_destroy(struct rtree_node* top_node) {
-    free(top_node);
+    // The top node spans the whole tree
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, top_node, (top_node->tree_size + 1) * sizeof(struct rtree_node));
 }
 
 uint16_t rtree_search(const struct rtree_node* nodes, const char* query_string, const unsigned int query_string_length) {
@@ -1,4 +1,5 @@
 #include "ctools/trie/trie.h"
+#include "ctools/alloc.h"
 
 struct print_node {
     struct trie_node* node_ptr;
@@ -8,10 +9,12 @@ struct print_node {
 #define STACK_NAME node_stack
 #define STACK_INDEX unsigned int
 #define STACK_TYPE struct trie_node*
+#define STACK_INLINE_CAPACITY 64
 #include "ctools/stack.h"
 #undef STACK_NAME
 #undef STACK_INDEX
 #undef STACK_TYPE
+#undef STACK_INLINE_CAPACITY
 
 
 void trie_node_init(struct trie_node* node) {
@@ -24,7 +27,7 @@ void trie_node_init(struct trie_node* node) {
 }
 
 struct trie_node* trie_create() {
-    struct trie_node* new_node = (struct trie_node*) malloc(sizeof(struct trie_node));
+    struct trie_node* new_node = (struct trie_node*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(struct trie_node));
 
     if (!new_node) {
         perror("malloc");
@@ -38,25 +41,51 @@ struct trie_node* trie_create() {
 
 void trie_node_destroy(struct trie_node* node) {
     if (node->subnodes_count)
-        free(node->subnodes);
+        CTOOLS_FREE(CTOOLS_ALLOC_CTX, node->subnodes, node->subnodes_count * sizeof(struct trie_node));
 
     trie_node_init(node);
 }
 
 void trie_destroy(struct trie_node* top_node) {
-    struct trie_node* current_node;
-    node_stack deletion_queue;
-    node_stack_create(&deletion_queue, 0);
-    node_stack_push(&deletion_queue, top_node);
-
-    // Delete nodes from the top down
-    while (!node_stack_pop(&deletion_queue, &current_node)) {
-        // First, empty the subnode array into the deletion stack before freeing the array
-        for (int i = 0; i < current_node->subnodes_count; i++)
-            node_stack_push(&deletion_queue, &current_node->subnodes[i]);
-        
-        trie_node_destroy(current_node);
+    struct trie_node* current_node = top_node;
+    struct trie_node* parent_node;
+
+    // Only the path from the top node down to the current node is kept on the stack,
+    // so it is as deep as the trie rather than as large as it
+    node_stack parents;
+    node_stack_create(&parents, 0);
+
+    while (current_node) {
+        // Go down to the first node without subnodes
+        while (current_node->subnodes_count) {
+            node_stack_push(&parents, current_node);
+            current_node = &current_node->subnodes[0];
+        }
+
+        // Delete nodes from the bottom up. A subnode array holds the nodes themselves,
+        // so it may only be freed once the subnodes of those nodes are gone.
+        for (;;) {
+            trie_node_destroy(current_node);
+
+            // The top node is done
+            if (node_stack_pop(&parents, &parent_node)) {
+                current_node = NULL;
+                break;
+            }
+
+            // Go on with the next sibling, or with the parent once all of its subnodes are done
+            if (++current_node < parent_node->subnodes + parent_node->subnodes_count) {
+                node_stack_push(&parents, parent_node);
+                break;
+            }
+
+            current_node = parent_node;
+        }
     }
+
+    node_stack_destroy(&parents);
+
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, top_node, sizeof(struct trie_node));
 }
 
 struct trie_node* _trie_search(struct trie_node* top_node, const char* string, unsigned int string_length, unsigned int* depth) {
@@ -104,7 +133,7 @@ int trie_add(struct trie_node* top_node, const char* string, void* value) {
     for (;search_depth < string_length; search_depth++) {
         if (node_to_extend->subnodes_count) {
             const unsigned int new_array_size = node_to_extend->subnodes_count + 1;
-            struct trie_node* new_array = (struct trie_node*) realloc(node_to_extend->subnodes, new_array_size * sizeof(struct trie_node));
+            struct trie_node* new_array = (struct trie_node*) CTOOLS_REALLOC(CTOOLS_ALLOC_CTX, node_to_extend->subnodes, node_to_extend->subnodes_count * sizeof(struct trie_node), new_array_size * sizeof(struct trie_node));
 
             if (!new_array) {
                 perror("realloc");
@@ -116,7 +145,13 @@ int trie_add(struct trie_node* top_node, const char* string, void* value) {
             node_to_extend->subnodes = new_array;
             node_to_extend->subnodes_count = new_array_size;
         } else {
-            node_to_extend->subnodes = (struct trie_node*) malloc(sizeof(struct trie_node));
+            node_to_extend->subnodes = (struct trie_node*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, sizeof(struct trie_node));
+
+            if (!node_to_extend->subnodes) {
+                perror("malloc");
+                return -1;
+            }
+
             trie_node_init(node_to_extend->subnodes);
             node_to_extend->subnodes_count = 1;
         }
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ctools/uring.h"
+#include "ctools/alloc.h"
+
+static inline int sys_io_uring_setup(unsigned int entries, struct io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned int opcode, const void* arg, unsigned int nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int ct_uring_init(struct ct_uring* ring, const unsigned int entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = sys_io_uring_setup(entries, &params);
+    if (fd < 0)
+        return -1;
+
+    // Reading from the current file position is needed to treat pipes, sockets and files alike
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    const size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    const size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Map the rings shared with the kernel
+    void* sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void* cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqes    = mmap(NULL, sqes_size,    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+        const int error = errno;
+
+        if (sq_ring != MAP_FAILED)
+            munmap(sq_ring, sq_ring_size);
+        if (cq_ring != MAP_FAILED)
+            munmap(cq_ring, cq_ring_size);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    *ring = (struct ct_uring) {
+        .ring_fd = fd,
+
+        .sq_entries = params.sq_entries,
+        .sq_tail = *(unsigned int*)(sq_ring + params.sq_off.tail),
+        .sq_submitted = *(unsigned int*)(sq_ring + params.sq_off.tail),
+        .sq_khead = sq_ring + params.sq_off.head,
+        .sq_ktail = sq_ring + params.sq_off.tail,
+        .sq_kmask = sq_ring + params.sq_off.ring_mask,
+        .sq_karray = sq_ring + params.sq_off.array,
+        .sqes = sqes,
+
+        .cq_khead = cq_ring + params.cq_off.head,
+        .cq_ktail = cq_ring + params.cq_off.tail,
+        .cq_kmask = cq_ring + params.cq_off.ring_mask,
+        .cqes = cq_ring + params.cq_off.cqes,
+
+        .sq_ring = sq_ring,
+        .sq_ring_size = sq_ring_size,
+        .cq_ring = cq_ring,
+        .cq_ring_size = cq_ring_size,
+        .sqes_size = sqes_size,
+    };
+
+    return 0;
+}
+
+void ct_uring_exit(struct ct_uring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->ring_fd);
+
+    // Zero out the struct
+    memset(ring, 0, sizeof(struct ct_uring));
+}
+
+int ct_uring_register_cbufs(struct ct_uring* ring, struct ct_cbuf* const* cbufs, const unsigned int count) {
+    const size_t iovecs_size = count * sizeof(struct iovec);
+    struct iovec* iovecs = (struct iovec*) CTOOLS_ALLOC(CTOOLS_ALLOC_CTX, iovecs_size);
+    if (!iovecs) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Register the whole doubled address space, since a transfer may run into the mirrored half
+    for (unsigned int i = 0; i < count; i++)
+        iovecs[i] = (struct iovec) {
+            .iov_base = cbufs[i]->buffer,
+            .iov_len = (size_t) cbufs[i]->capacity * 2,
+        };
+
+    // Drop the previous set, if any
+    sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+    const int res = sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, count);
+
+    CTOOLS_FREE(CTOOLS_ALLOC_CTX, iovecs, iovecs_size);
+
+    return res < 0 ? -1 : 0;
+}
+
+int ct_uring_unregister_cbufs(struct ct_uring* ring) {
+    return sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0) < 0 ? -1 : 0;
+}
+
+/**
+ * Claims the next free submission queue entry, or returns NULL if the submission queue is full.
+ */
+static struct io_uring_sqe* get_sqe(struct ct_uring* ring) {
+    const unsigned int head = __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_tail - head >= ring->sq_entries)
+        return NULL;
+
+    const unsigned int index = ring->sq_tail++ & *ring->sq_kmask;
+    ring->sq_karray[index] = index;
+
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+static int prep_transfer(struct ct_uring* ring, struct ct_uring_op* op, struct ct_cbuf* cbuf, int fd, int buf_index,
+                         enum ct_uring_op_type type, void* addr, CT_CBUF_INDEX len) {
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    op->cbuf = cbuf;
+    op->type = type;
+    op->result = 0;
+
+    if (type == CT_URING_FILL)
+        sqe->opcode = buf_index < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = buf_index < 0 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED;
+
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t) addr;
+
+    // The result of a transfer is reported as an int
+    sqe->len = len > INT_MAX ? INT_MAX : len;
+
+    sqe->off = (uint64_t) -1;
+    sqe->buf_index = buf_index < 0 ? 0 : buf_index;
+    sqe->user_data = (uint64_t)(uintptr_t) op;
+
+    return 0;
+}
+
+int ct_uring_prep_fill(struct ct_uring* ring, struct ct_uring_op* op, struct ct_cbuf* cbuf, int fd, int buf_index) {
+    CT_CBUF_INDEX available;
+    void* dst = ct_cbuf_write_reserve(cbuf, &available);
+
+    if (available == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    return prep_transfer(ring, op, cbuf, fd, buf_index, CT_URING_FILL, dst, available);
+}
+
+int ct_uring_prep_drain(struct ct_uring* ring, struct ct_uring_op* op, struct ct_cbuf* cbuf, int fd, int buf_index) {
+    CT_CBUF_INDEX available;
+    const void* src = ct_cbuf_peek(cbuf, &available);
+
+    if (available == 0) {
+        errno = ENODATA;
+        return -1;
+    }
+
+    return prep_transfer(ring, op, cbuf, fd, buf_index, CT_URING_DRAIN, (void*) src, available);
+}
+
+int ct_uring_submit(struct ct_uring* ring, const unsigned int wait_count) {
+    const unsigned int to_submit = ring->sq_tail - ring->sq_submitted;
+
+    // Publish the new entries to the kernel
+    __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+
+    int res;
+    do {
+        res = sys_io_uring_enter(ring->ring_fd, to_submit, wait_count, wait_count ? IORING_ENTER_GETEVENTS : 0);
+    } while (res < 0 && errno == EINTR);
+
+    if (res < 0)
+        return -1;
+
+    ring->sq_submitted += res;
+
+    return res;
+}
+
+int ct_uring_reap(struct ct_uring* ring, struct ct_uring_op** done, const unsigned int max, const unsigned int min_count) {
+    unsigned int head = *ring->cq_khead;
+    unsigned int tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+
+    // Block in the kernel until enough operations have finished
+    if (tail - head < min_count) {
+        int res;
+        do {
+            res = sys_io_uring_enter(ring->ring_fd, 0, min_count, IORING_ENTER_GETEVENTS);
+        } while (res < 0 && errno == EINTR);
+
+        if (res < 0)
+            return -1;
+
+        tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned int count = 0;
+
+    for (; head != tail && count < max; head++, count++) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_kmask];
+        struct ct_uring_op* op = (struct ct_uring_op*)(uintptr_t) cqe->user_data;
+
+        op->result = cqe->res;
+
+        // Apply the transfer to the circular buffer
+        if (op->result > 0) {
+            if (op->type == CT_URING_FILL)
+                ct_cbuf_write_commit(op->cbuf, op->result);
+            else
+                ct_cbuf_consume(op->cbuf, op->result);
+        }
+
+        done[count] = op;
+    }
+
+    // Hand the reaped entries back to the kernel
+    __atomic_store_n(ring->cq_khead, head, __ATOMIC_RELEASE);
+
+    return count;
+}
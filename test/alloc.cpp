@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+struct counting_allocator {
+    size_t allocations;
+    size_t frees;
+    size_t bytes_in_use;
+};
+
+static counting_allocator* current_allocator;
+
+static void* counting_alloc(counting_allocator* a, size_t size) {
+    a->allocations++;
+    a->bytes_in_use += size;
+    return malloc(size);
+}
+
+static void* counting_realloc(counting_allocator* a, void* ptr, size_t old_size, size_t new_size) {
+    void* new_ptr = realloc(ptr, new_size);
+    if (new_ptr)
+        a->bytes_in_use += new_size - old_size;
+    return new_ptr;
+}
+
+static void counting_free(counting_allocator* a, void* ptr, size_t size) {
+    a->frees++;
+    a->bytes_in_use -= size;
+    free(ptr);
+}
+
+#define CTOOLS_ALLOC_CTX current_allocator
+#define CTOOLS_ALLOC(ctx, size) counting_alloc((ctx), (size))
+#define CTOOLS_REALLOC(ctx, ptr, old_size, new_size) counting_realloc((ctx), (ptr), (old_size), (new_size))
+#define CTOOLS_FREE(ctx, ptr, size) counting_free((ctx), (ptr), (size))
+
+#define STACK_NAME stack
+#define STACK_TYPE int
+extern "C" {
+    #include "ctools/stack.h"
+}
+
+#define QUEUE_NAME queue
+#define QUEUE_TYPE int
+#define QUEUE_INDEX unsigned int
+extern "C" {
+    #include "ctools/queue.h"
+}
+
+#undef STACK_NAME
+#undef STACK_TYPE
+#define HEAP_NAME heap
+#define HEAP_TYPE int
+#define HEAP_COMP(a,b) b - a
+extern "C" {
+    #include "ctools/heap.h"
+}
+
+TEST(alloc, stack_uses_hooks) {
+    counting_allocator a = {};
+    current_allocator = &a;
+
+    stack s;
+    ASSERT_EQ(stack_create(&s, 4), 0);
+    EXPECT_EQ(a.allocations, 1u);
+
+    // Grow and shrink the array a few times
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(stack_push(&s, i), 0);
+
+    int value;
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(stack_pop(&s, &value), 0);
+
+    stack_destroy(&s);
+
+    EXPECT_EQ(a.frees, a.allocations);
+    EXPECT_EQ(a.bytes_in_use, 0u);
+}
+
+TEST(alloc, queue_uses_hooks) {
+    counting_allocator a = {};
+    current_allocator = &a;
+
+    queue* q = queue_create(100);
+    ASSERT_NE(q, nullptr);
+    EXPECT_EQ(a.allocations, 2u);
+
+    queue_destroy(q);
+
+    EXPECT_EQ(a.frees, a.allocations);
+    EXPECT_EQ(a.bytes_in_use, 0u);
+}
+
+TEST(alloc, heap_uses_hooks) {
+    counting_allocator a = {};
+    current_allocator = &a;
+
+    heap* h = heap_create(1);
+    ASSERT_NE(h, nullptr);
+
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(heap_push(h, i), 0);
+
+    int value;
+    for (int i = 0; i < 900; i++)
+        ASSERT_EQ(heap_pop(h, &value), 0);
+
+    heap_destroy(h);
+
+    EXPECT_EQ(a.allocations, 2u);
+    EXPECT_EQ(a.frees, a.allocations);
+    EXPECT_EQ(a.bytes_in_use, 0u);
+}
@@ -1,5 +1,11 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 extern "C" {
     #include "ctools/cbuf.h"
@@ -37,4 +43,381 @@ TEST(cbuf, trigger_rollover) {
     }
 
     ct_cbuf_exit(&circular_buffer);
-}
\ No newline at end of file
+}
+
+TEST(cbuf, zero_copy_access_across_rollover) {
+    // Uses a record size that does not divide the page size,
+    // so that some records straddle the end of the first half.
+    const unsigned int record_count = 5000;
+    const unsigned int record_size = 3 * sizeof(unsigned int);
+
+    struct ct_cbuf circular_buffer;
+    int res = ct_cbuf_init(&circular_buffer, 1);
+    EXPECT_EQ(res, 0);
+
+    for (unsigned int i = 0; i < record_count; i++) {
+        CT_CBUF_INDEX available;
+
+        // Produce a record directly into the buffer
+        unsigned int* record = (unsigned int*) ct_cbuf_write_reserve(&circular_buffer, &available);
+        EXPECT_GE(available, record_size);
+
+        record[0] = i;
+        record[1] = i * 2;
+        record[2] = i * 3;
+
+        // Nothing is readable until the record is committed
+        EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), 0u);
+        EXPECT_EQ(ct_cbuf_write_commit(&circular_buffer, record_size), 0);
+
+        // Decode the record directly from the buffer
+        const unsigned int* view = (const unsigned int*) ct_cbuf_peek(&circular_buffer, &available);
+        EXPECT_EQ(available, record_size);
+        EXPECT_EQ(view[0], i);
+        EXPECT_EQ(view[1], i * 2);
+        EXPECT_EQ(view[2], i * 3);
+
+        EXPECT_EQ(ct_cbuf_consume(&circular_buffer, record_size), 0);
+    }
+
+    // Committing or consuming more than what is available is rejected
+    EXPECT_EQ(ct_cbuf_consume(&circular_buffer, 1), -1);
+    EXPECT_EQ(ct_cbuf_write_commit(&circular_buffer, circular_buffer.capacity + 1), -1);
+
+    ct_cbuf_exit(&circular_buffer);
+}
+
+
+TEST(cbuf, fill_and_drain_through_file_descriptors) {
+    // Source and sink are two ends of the same socket pair,
+    // so the data makes a full round trip through the buffer.
+    int sockets[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    struct ct_cbuf circular_buffer;
+    EXPECT_EQ(ct_cbuf_init(&circular_buffer, 1), 0);
+
+    const unsigned int message_size = 3000;
+    unsigned char message[message_size], received[message_size];
+
+    for (int round = 0; round < 10; round++) {
+        for (unsigned int i = 0; i < message_size; i++)
+            message[i] = round + i;
+
+        EXPECT_EQ(write(sockets[0], message, message_size), (ssize_t) message_size);
+        EXPECT_EQ(ct_cbuf_fill_from_fd(&circular_buffer, sockets[1]), (ssize_t) message_size);
+
+        EXPECT_EQ(ct_cbuf_drain_to_fd(&circular_buffer, sockets[1]), (ssize_t) message_size);
+        EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), 0u);
+
+        EXPECT_EQ(read(sockets[0], received, message_size), (ssize_t) message_size);
+        EXPECT_EQ(memcmp(message, received, message_size), 0);
+    }
+
+    // Draining an empty buffer writes nothing
+    EXPECT_EQ(ct_cbuf_drain_to_fd(&circular_buffer, sockets[1]), 0);
+
+    // Filling a full buffer is reported as an error rather than end-of-file
+    CT_CBUF_INDEX available;
+    ct_cbuf_write_reserve(&circular_buffer, &available);
+    ct_cbuf_write_commit(&circular_buffer, available);
+    EXPECT_EQ(ct_cbuf_fill_from_fd(&circular_buffer, sockets[1]), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+
+    // Closing the writing end is reported as end-of-file
+    ct_cbuf_consume(&circular_buffer, available);
+    close(sockets[0]);
+    EXPECT_EQ(ct_cbuf_fill_from_fd(&circular_buffer, sockets[1]), 0);
+
+    close(sockets[1]);
+    ct_cbuf_exit(&circular_buffer);
+}
+
+TEST(cbuf, splice_between_sockets_and_pipes) {
+    // Socket -> pipe -> buffer -> pipe -> socket, the way a proxy passes data through
+    int sockets[2], in_pipe[2], out_pipe[2], tap[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    EXPECT_EQ(pipe(in_pipe), 0);
+    EXPECT_EQ(pipe(out_pipe), 0);
+    EXPECT_EQ(pipe(tap), 0);
+
+    struct ct_cbuf circular_buffer;
+    EXPECT_EQ(ct_cbuf_init(&circular_buffer, 1), 0);
+
+    const unsigned int message_size = 3000;
+    unsigned char message[message_size], received[message_size];
+
+    // Every other round also mirrors the data to the tap. The rounds wrap around the buffer.
+    for (int round = 0; round < 10; round++) {
+        const int tap_fd = round % 2 ? tap[1] : -1;
+
+        for (unsigned int i = 0; i < message_size; i++)
+            message[i] = round * 3 + i;
+
+        EXPECT_EQ(write(sockets[0], message, message_size), (ssize_t) message_size);
+        EXPECT_EQ(splice(sockets[1], NULL, in_pipe[1], NULL, message_size, 0), (ssize_t) message_size);
+
+        // A transfer stops at the end of the memfd, so it may take two of them
+        unsigned int moved = 0;
+        while (moved < message_size) {
+            const ssize_t res = ct_cbuf_splice_in(&circular_buffer, in_pipe[0], tap_fd);
+            EXPECT_GT(res, 0);
+            if (res <= 0)
+                break;
+            moved += res;
+        }
+
+        EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), message_size);
+        EXPECT_EQ(memcmp(ct_cbuf_peek(&circular_buffer, NULL), message, message_size), 0);
+
+        // The occupied space is contiguous, so one transfer moves all of it
+        EXPECT_EQ(ct_cbuf_splice_out(&circular_buffer, out_pipe[1]), (ssize_t) message_size);
+        EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), 0u);
+
+        // Empty the pipe before the buffer is written to again
+        EXPECT_EQ(splice(out_pipe[0], NULL, sockets[1], NULL, message_size, 0), (ssize_t) message_size);
+        EXPECT_EQ(read(sockets[0], received, message_size), (ssize_t) message_size);
+        EXPECT_EQ(memcmp(message, received, message_size), 0);
+
+        if (tap_fd >= 0) {
+            EXPECT_EQ(read(tap[0], received, message_size), (ssize_t) message_size);
+            EXPECT_EQ(memcmp(message, received, message_size), 0);
+        }
+    }
+
+    // The tap received every byte once, and nothing more
+    EXPECT_EQ(fcntl(tap[0], F_SETFL, O_NONBLOCK), 0);
+    EXPECT_EQ(read(tap[0], received, 1), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    // Splicing out of an empty buffer moves nothing
+    EXPECT_EQ(ct_cbuf_splice_out(&circular_buffer, out_pipe[1]), 0);
+
+    // Splicing into a full buffer is reported as an error rather than end-of-file
+    CT_CBUF_INDEX available;
+    ct_cbuf_write_reserve(&circular_buffer, &available);
+    ct_cbuf_write_commit(&circular_buffer, available);
+    EXPECT_EQ(ct_cbuf_splice_in(&circular_buffer, in_pipe[0], -1), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+
+    // Closing the writing end of the pipe is reported as end-of-file
+    ct_cbuf_consume(&circular_buffer, available);
+    close(in_pipe[1]);
+    EXPECT_EQ(ct_cbuf_splice_in(&circular_buffer, in_pipe[0], -1), 0);
+
+    for (int fd : { sockets[0], sockets[1], in_pipe[0], out_pipe[0], out_pipe[1], tap[0], tap[1] })
+        close(fd);
+    ct_cbuf_exit(&circular_buffer);
+}
+
+TEST(cbuf_spsc, fill_and_drain_through_file_descriptors) {
+    int pipe_in[2], pipe_out[2];
+    EXPECT_EQ(pipe(pipe_in), 0);
+    EXPECT_EQ(pipe(pipe_out), 0);
+
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_init(&circular_buffer, 1), 0);
+
+    const unsigned int message_size = 3000;
+    unsigned char message[message_size], received[message_size];
+
+    for (int round = 0; round < 10; round++) {
+        for (unsigned int i = 0; i < message_size; i++)
+            message[i] = round * i;
+
+        EXPECT_EQ(write(pipe_in[1], message, message_size), (ssize_t) message_size);
+        EXPECT_EQ(ct_cbuf_spsc_fill_from_fd(&circular_buffer, pipe_in[0]), (ssize_t) message_size);
+        EXPECT_EQ(ct_cbuf_spsc_drain_to_fd(&circular_buffer, pipe_out[1]), (ssize_t) message_size);
+
+        EXPECT_EQ(read(pipe_out[0], received, message_size), (ssize_t) message_size);
+        EXPECT_EQ(memcmp(message, received, message_size), 0);
+    }
+
+    close(pipe_in[0]);
+    close(pipe_in[1]);
+    close(pipe_out[0]);
+    close(pipe_out[1]);
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
+
+
+TEST(cbuf, huge_pages_fall_back_to_normal_pages) {
+    const size_t normal_page_size = sysconf(_SC_PAGESIZE);
+
+    struct ct_cbuf circular_buffer;
+    EXPECT_EQ(ct_cbuf_init_ex(&circular_buffer, 1, CT_CBUF_HUGE_2MB | CT_CBUF_HUGE_1GB), 0);
+
+    // Depending on what the system has to spare, any of the page sizes may have been used
+    EXPECT_TRUE(circular_buffer.page_size == normal_page_size ||
+                circular_buffer.page_size == 1 << 21 ||
+                circular_buffer.page_size == 1 << 30);
+    EXPECT_EQ(circular_buffer.capacity % circular_buffer.page_size, 0u);
+    EXPECT_EQ((size_t) circular_buffer.buffer % circular_buffer.page_size, 0u);
+
+    // The mirroring must hold regardless of the page size
+    unsigned char* bytes = (unsigned char*) circular_buffer.buffer;
+    bytes[0] = 42;
+    bytes[circular_buffer.capacity - 1] = 24;
+    EXPECT_EQ(bytes[circular_buffer.capacity], 42);
+    EXPECT_EQ(bytes[circular_buffer.capacity * 2 - 1], 24);
+
+    ct_cbuf_exit(&circular_buffer);
+
+    // Without flags, normal pages are used
+    EXPECT_EQ(ct_cbuf_init_ex(&circular_buffer, 1, 0), 0);
+    EXPECT_EQ(circular_buffer.page_size, normal_page_size);
+    ct_cbuf_exit(&circular_buffer);
+}
+
+
+// Fills a buffer so the data wraps around the end of its capacity, then grows it and verifies the data.
+static void grow_while_wrapped(const unsigned int wrapped_bytes, const unsigned int grow_by_pages) {
+    const long page_size = sysconf(_SC_PAGESIZE);
+
+    struct ct_cbuf circular_buffer;
+    EXPECT_EQ(ct_cbuf_init(&circular_buffer, page_size), 0);
+
+    // Move the indices close to the end of the buffer
+    const unsigned int unwrapped_bytes = page_size - wrapped_bytes;
+    CT_CBUF_INDEX available;
+    ct_cbuf_write_reserve(&circular_buffer, &available);
+    ct_cbuf_write_commit(&circular_buffer, page_size - unwrapped_bytes);
+    ct_cbuf_consume(&circular_buffer, page_size - unwrapped_bytes);
+
+    // Fill the buffer completely, so the data wraps
+    std::vector<unsigned char> expected(page_size);
+    for (long i = 0; i < page_size; i++)
+        expected[i] = i * 13;
+
+    EXPECT_EQ(ct_cbuf_write(&circular_buffer, expected.data(), page_size), page_size);
+
+    EXPECT_EQ(ct_cbuf_grow(&circular_buffer, page_size * (1 + grow_by_pages)), 0);
+    EXPECT_EQ(circular_buffer.capacity, page_size * (1 + grow_by_pages));
+    EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), page_size);
+
+    // The new space must be usable right after the old data
+    std::vector<unsigned char> more(page_size * grow_by_pages, 7);
+    EXPECT_EQ(ct_cbuf_write(&circular_buffer, more.data(), more.size()), (ssize_t) more.size());
+
+    std::vector<unsigned char> actual(page_size);
+    EXPECT_EQ(ct_cbuf_read(&circular_buffer, actual.data(), page_size), page_size);
+    EXPECT_EQ(expected, actual);
+
+    std::vector<unsigned char> actual_more(more.size());
+    EXPECT_EQ(ct_cbuf_read(&circular_buffer, actual_more.data(), more.size()), (ssize_t) more.size());
+    EXPECT_EQ(more, actual_more);
+
+    ct_cbuf_exit(&circular_buffer);
+}
+
+TEST(cbuf, grow_keeps_data) {
+    // Not wrapped at all
+    grow_while_wrapped(0, 1);
+
+    // Mostly unwrapped, so the wrapped part is appended to the older part
+    grow_while_wrapped(100, 1);
+    grow_while_wrapped(100, 3);
+
+    // Mostly wrapped, so the older part is moved to the end
+    grow_while_wrapped(4000, 1);
+    grow_while_wrapped(4000, 3);
+}
+
+TEST(cbuf, shrink_only_when_empty) {
+    const long page_size = sysconf(_SC_PAGESIZE);
+
+    struct ct_cbuf circular_buffer;
+    EXPECT_EQ(ct_cbuf_init(&circular_buffer, page_size * 4), 0);
+
+    EXPECT_EQ(ct_cbuf_write(&circular_buffer, "data", 4), 4);
+    EXPECT_EQ(ct_cbuf_shrink(&circular_buffer, 1), -1);
+    EXPECT_EQ(errno, EBUSY);
+    EXPECT_EQ(circular_buffer.capacity, page_size * 4);
+
+    char sink[4];
+    EXPECT_EQ(ct_cbuf_read(&circular_buffer, sink, 4), 4);
+    EXPECT_EQ(ct_cbuf_shrink(&circular_buffer, 1), 0);
+    EXPECT_EQ(circular_buffer.capacity, page_size);
+
+    // The shrunk buffer is still mirrored
+    unsigned char* bytes = (unsigned char*) circular_buffer.buffer;
+    bytes[0] = 42;
+    EXPECT_EQ(bytes[circular_buffer.capacity], 42);
+
+    ct_cbuf_exit(&circular_buffer);
+}
+
+TEST(cbuf, journal_recovers_synced_data) {
+    char path[] = "/tmp/ct_cbuf_journal_XXXXXX";
+    const int fd = mkstemp(path);
+    EXPECT_GE(fd, 0);
+    unlink(path);
+
+    const unsigned int record_size = 1000;
+    unsigned char record[record_size], received[record_size];
+
+    struct ct_cbuf journal;
+    EXPECT_EQ(ct_cbuf_init_file(&journal, fd, 1), 0);
+    const unsigned int capacity = journal.capacity;
+
+    // Wrap around once, so the recovered data is split across the end of the file
+    for (unsigned int i = 0; i < capacity - 100; i++)
+        EXPECT_EQ(ct_cbuf_write(&journal, "x", 1), 1);
+    EXPECT_EQ(ct_cbuf_sync_start(&journal), 0);
+    EXPECT_EQ(ct_cbuf_consume(&journal, capacity - 100), 0);
+
+    for (unsigned int i = 0; i < record_size; i++)
+        record[i] = i * 13;
+    EXPECT_EQ(ct_cbuf_write(&journal, record, record_size), record_size);
+    EXPECT_EQ(ct_cbuf_sync(&journal), 0);
+
+    // Data written after the last sync is not part of the journal after a crash
+    pid_t pid = fork();
+    if (pid == 0) {
+        ct_cbuf_write(&journal, "lost", 4);
+        _exit(0);
+    }
+    int status;
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+
+    // Recover from a fresh mapping, without calling ct_cbuf_exit() on the first one
+    struct ct_cbuf recovered;
+    EXPECT_EQ(ct_cbuf_init_file(&recovered, fd, 1), 0);
+    EXPECT_EQ(recovered.capacity, capacity);
+    EXPECT_EQ(ct_cbuf_space_occupied(&recovered), record_size);
+    EXPECT_EQ(memcmp(ct_cbuf_peek(&recovered, NULL), record, record_size), 0);
+
+    // The first mapping still holds the synced state, so its exit stores the same indices
+    ct_cbuf_exit(&journal);
+
+    // A clean exit syncs the journal
+    EXPECT_EQ(ct_cbuf_write(&recovered, "kept", 4), 4);
+    ct_cbuf_exit(&recovered);
+
+    EXPECT_EQ(ct_cbuf_init_file(&recovered, fd, 1), 0);
+    EXPECT_EQ(ct_cbuf_read(&recovered, received, record_size), record_size);
+    EXPECT_EQ(memcmp(record, received, record_size), 0);
+    EXPECT_EQ(ct_cbuf_read(&recovered, received, record_size), 4);
+    EXPECT_EQ(memcmp("kept", received, 4), 0);
+
+    // File-backed buffers cannot change their capacity
+    EXPECT_EQ(ct_cbuf_grow(&recovered, capacity * 2), -1);
+    EXPECT_EQ(errno, EPERM);
+
+    ct_cbuf_exit(&recovered);
+
+    // Files holding something else are rejected
+    EXPECT_EQ(ftruncate(fd, 0), 0);
+    EXPECT_EQ(pwrite(fd, "not a journal", 13, 0), 13);
+    EXPECT_EQ(ct_cbuf_init_file(&recovered, fd, 1), -1);
+    EXPECT_EQ(errno, EINVAL);
+
+    // Syncing only applies to file-backed buffers
+    struct ct_cbuf anonymous;
+    EXPECT_EQ(ct_cbuf_init(&anonymous, 1), 0);
+    EXPECT_EQ(ct_cbuf_sync(&anonymous), -1);
+    EXPECT_EQ(errno, EINVAL);
+    ct_cbuf_exit(&anonymous);
+
+    close(fd);
+}
@@ -0,0 +1,264 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern "C" {
+    #include "ctools/cbuf.h"
+}
+
+TEST(cbuf_spsc, producer_and_consumer_threads) {
+    // Transfers enough data to wrap around the buffer many times, using a chunk size
+    // that is intentionally non-aligned with both the page size and the element size.
+    const unsigned int int_count = 1'000'000;
+    const unsigned int chunk_size = 1000;
+
+    struct ct_cbuf_spsc circular_buffer;
+    int res = ct_cbuf_spsc_init(&circular_buffer, 1);
+    EXPECT_EQ(res, 0);
+
+    std::thread producer([&circular_buffer](){
+        unsigned int next = 0;
+
+        while (next < int_count) {
+            CT_CBUF_INDEX available;
+            unsigned char* dst = (unsigned char*) ct_cbuf_spsc_write_reserve(&circular_buffer, sizeof(unsigned int), &available);
+            if (!dst) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Write as many whole integers as fit, up to the chunk size
+            unsigned int count = available < chunk_size ? available : chunk_size;
+            count /= sizeof(unsigned int);
+            if (count > int_count - next)
+                count = int_count - next;
+
+            for (unsigned int i = 0; i < count; i++, next++)
+                memcpy(dst + i * sizeof(unsigned int), &next, sizeof(unsigned int));
+
+            EXPECT_EQ(ct_cbuf_spsc_write_commit(&circular_buffer, count * sizeof(unsigned int)), 0);
+        }
+    });
+
+    std::thread consumer([&circular_buffer](){
+        unsigned int expected = 0;
+        unsigned int mismatches = 0;
+
+        while (expected < int_count) {
+            unsigned int value;
+            if (ct_cbuf_spsc_read(&circular_buffer, &value, sizeof(value)) != sizeof(value)) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            mismatches += value != expected++;
+        }
+
+        EXPECT_EQ(mismatches, 0u);
+    });
+
+    producer.join();
+    consumer.join();
+
+    EXPECT_EQ(ct_cbuf_spsc_space_occupied(&circular_buffer), 0u);
+    EXPECT_EQ(ct_cbuf_spsc_space_left(&circular_buffer), circular_buffer.capacity);
+
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
+
+TEST(cbuf_spsc, full_and_empty_are_distinguishable) {
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_init(&circular_buffer, 1), 0);
+
+    const unsigned int capacity = circular_buffer.capacity;
+    unsigned char pattern[capacity], sink[capacity];
+
+    for (unsigned int i = 0; i < capacity; i++)
+        pattern[i] = i * 7;
+
+    // Fill and drain the buffer completely, a few times over
+    for (int round = 0; round < 5; round++) {
+        EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, pattern, capacity), (ssize_t) capacity);
+        EXPECT_EQ(ct_cbuf_spsc_space_left(&circular_buffer), 0u);
+        EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, pattern, 1), -1);
+
+        EXPECT_EQ(ct_cbuf_spsc_read(&circular_buffer, sink, capacity), (ssize_t) capacity);
+        EXPECT_EQ(memcmp(pattern, sink, capacity), 0);
+        EXPECT_EQ(ct_cbuf_spsc_read(&circular_buffer, sink, 1), 0);
+
+        // Shift the indices so the next round wraps
+        EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, pattern, 100), 100);
+        EXPECT_EQ(ct_cbuf_spsc_read(&circular_buffer, sink, 100), 100);
+    }
+
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
+
+TEST(cbuf_spsc, producer_and_consumer_processes) {
+    const unsigned int int_count = 1'000'000;
+
+    int sockets[2];
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0) {
+        // The child process attaches to the buffer of the parent, and produces into it
+        struct ct_cbuf_spsc circular_buffer;
+        if (ct_cbuf_spsc_attach(&circular_buffer, sockets[1]))
+            _exit(1);
+
+        for (unsigned int i = 0; i < int_count; i++)
+            while (ct_cbuf_spsc_write(&circular_buffer, &i, sizeof(i)) != sizeof(i))
+                std::this_thread::yield();
+
+        ct_cbuf_spsc_exit(&circular_buffer);
+        _exit(0);
+    }
+
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_init(&circular_buffer, 1), 0);
+    EXPECT_EQ(ct_cbuf_spsc_export(&circular_buffer, sockets[0]), 0);
+
+    unsigned int expected = 0;
+    unsigned int mismatches = 0;
+
+    while (expected < int_count) {
+        unsigned int value;
+        if (ct_cbuf_spsc_read(&circular_buffer, &value, sizeof(value)) != sizeof(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        mismatches += value != expected++;
+    }
+
+    EXPECT_EQ(mismatches, 0u);
+
+    int status;
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
+
+TEST(cbuf_spsc, attach_rejects_foreign_file_descriptors) {
+    // A plain ct_cbuf has no control page to describe its layout
+    struct ct_cbuf plain;
+    EXPECT_EQ(ct_cbuf_init(&plain, 1), 0);
+
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_attach_fd(&circular_buffer, dup(plain.memfd)), -1);
+    EXPECT_EQ(errno, EINVAL);
+
+    ct_cbuf_exit(&plain);
+}
+
+TEST(cbuf_spsc, blocking_producer_and_consumer_threads) {
+    const unsigned int int_count = 200'000;
+
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_init(&circular_buffer, 1), 0);
+
+    std::thread producer([&circular_buffer](){
+        for (unsigned int next = 0; next < int_count; next++) {
+            EXPECT_EQ(ct_cbuf_spsc_wait_writable(&circular_buffer, sizeof(next), -1), 0);
+            EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, &next, sizeof(next)), (ssize_t) sizeof(next));
+
+            // Let the consumer run dry every now and then, so it has to sleep
+            if (next % 10'000 == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+
+    std::thread consumer([&circular_buffer](){
+        unsigned int mismatches = 0;
+
+        for (unsigned int expected = 0; expected < int_count; expected++) {
+            unsigned int value;
+            EXPECT_EQ(ct_cbuf_spsc_wait_readable(&circular_buffer, sizeof(value), -1), 0);
+            EXPECT_EQ(ct_cbuf_spsc_read(&circular_buffer, &value, sizeof(value)), (ssize_t) sizeof(value));
+
+            mismatches += value != expected;
+        }
+
+        EXPECT_EQ(mismatches, 0u);
+    });
+
+    producer.join();
+    consumer.join();
+
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
+
+TEST(cbuf_spsc, wait_times_out) {
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_init(&circular_buffer, 1), 0);
+
+    const unsigned int capacity = circular_buffer.capacity;
+
+    // Empty
+    EXPECT_EQ(ct_cbuf_spsc_wait_readable(&circular_buffer, 1, 0), -1);
+    EXPECT_EQ(errno, ETIMEDOUT);
+    EXPECT_EQ(ct_cbuf_spsc_wait_readable(&circular_buffer, 1, 20), -1);
+    EXPECT_EQ(errno, ETIMEDOUT);
+    EXPECT_EQ(ct_cbuf_spsc_wait_writable(&circular_buffer, capacity, 0), 0);
+    EXPECT_EQ(ct_cbuf_spsc_wait_writable(&circular_buffer, capacity + 1, 0), -1);
+    EXPECT_EQ(errno, EINVAL);
+
+    // Full
+    EXPECT_NE(ct_cbuf_spsc_write_reserve(&circular_buffer, capacity, NULL), nullptr);
+    EXPECT_EQ(ct_cbuf_spsc_write_commit(&circular_buffer, capacity), 0);
+    EXPECT_EQ(ct_cbuf_spsc_wait_writable(&circular_buffer, 1, 20), -1);
+    EXPECT_EQ(errno, ETIMEDOUT);
+    EXPECT_EQ(ct_cbuf_spsc_wait_readable(&circular_buffer, capacity, 0), 0);
+
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
+
+TEST(cbuf_spsc, eventfd_signals_new_data) {
+    struct ct_cbuf_spsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_spsc_init(&circular_buffer, 1), 0);
+
+    const int efd = ct_cbuf_spsc_eventfd(&circular_buffer);
+    EXPECT_GE(efd, 0);
+    EXPECT_EQ(ct_cbuf_spsc_eventfd(&circular_buffer), efd);
+
+    struct pollfd pfd = { .fd = efd, .events = POLLIN, .revents = 0 };
+    EXPECT_EQ(poll(&pfd, 1, 0), 0);
+
+    std::thread producer([&circular_buffer](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        const char data[] = "0123456789";
+        EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, data, 5), 5);
+        EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, data + 5, 5), 5);
+    });
+
+    // Wait the way an event loop would
+    EXPECT_EQ(poll(&pfd, 1, 5000), 1);
+    producer.join();
+
+    uint64_t counter;
+    EXPECT_EQ(read(efd, &counter, sizeof(counter)), (ssize_t) sizeof(counter));
+    EXPECT_EQ(counter, 1u);
+
+    // Drain until empty, after which the next write signals again
+    char sink[10];
+    EXPECT_EQ(ct_cbuf_spsc_read(&circular_buffer, sink, sizeof(sink)), 10);
+    EXPECT_EQ(memcmp(sink, "0123456789", 10), 0);
+    EXPECT_EQ(poll(&pfd, 1, 0), 0);
+
+    EXPECT_EQ(ct_cbuf_spsc_write(&circular_buffer, sink, 1), 1);
+    EXPECT_EQ(poll(&pfd, 1, 0), 1);
+
+    ct_cbuf_spsc_exit(&circular_buffer);
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include "ctools/cbuf_mpsc.h"
+}
+
+struct record {
+    unsigned int producer;
+    unsigned int sequence;
+};
+
+struct verification {
+    std::vector<unsigned int> next_sequence;
+    unsigned int frames;
+    unsigned int errors;
+};
+
+// Every frame holds a record, followed by a filler whose length and content depend on the record.
+static uint32_t payload_length(unsigned int sequence) {
+    return sizeof(struct record) + sequence % 61;
+}
+
+static void verify_frame(void* context, const void* payload, uint32_t length) {
+    struct verification* v = (struct verification*) context;
+    struct record r;
+    memcpy(&r, payload, sizeof(r));
+
+    // Frames from the same producer must arrive in order
+    v->errors += r.sequence != v->next_sequence[r.producer]++;
+    v->errors += length != payload_length(r.sequence);
+
+    const unsigned char* filler = (const unsigned char*) payload + sizeof(r);
+    for (uint32_t i = 0; i < length - sizeof(r); i++)
+        v->errors += filler[i] != (unsigned char)(r.sequence + i);
+
+    v->frames++;
+}
+
+TEST(cbuf_mpsc, producer_threads_and_consumer_thread) {
+    const unsigned int producer_count = 4;
+    const unsigned int frames_per_producer = 100'000;
+
+    struct ct_cbuf_mpsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_mpsc_init(&circular_buffer, 1), 0);
+
+    std::vector<std::thread> producers;
+    for (unsigned int p = 0; p < producer_count; p++) {
+        producers.emplace_back([&circular_buffer, p](){
+            for (unsigned int i = 0; i < frames_per_producer; i++) {
+                const uint32_t length = payload_length(i);
+
+                unsigned char* payload;
+                while (!(payload = (unsigned char*) ct_cbuf_mpsc_reserve(&circular_buffer, length)))
+                    std::this_thread::yield();
+
+                struct record r = { p, i };
+                memcpy(payload, &r, sizeof(r));
+                for (uint32_t y = 0; y < length - sizeof(r); y++)
+                    payload[sizeof(r) + y] = (unsigned char)(i + y);
+
+                ct_cbuf_mpsc_commit(&circular_buffer, payload);
+            }
+        });
+    }
+
+    struct verification v = { std::vector<unsigned int>(producer_count, 0), 0, 0 };
+
+    while (v.frames < producer_count * frames_per_producer)
+        if (!ct_cbuf_mpsc_read(&circular_buffer, verify_frame, &v, 64))
+            std::this_thread::yield();
+
+    for (auto& producer : producers)
+        producer.join();
+
+    EXPECT_EQ(v.errors, 0u);
+    for (unsigned int p = 0; p < producer_count; p++)
+        EXPECT_EQ(v.next_sequence[p], frames_per_producer);
+
+    ct_cbuf_mpsc_exit(&circular_buffer);
+}
+
+static void count_frame(void* context, const void*, uint32_t) {
+    (*(unsigned int*) context)++;
+}
+
+TEST(cbuf_mpsc, uncommitted_frames_hold_back_later_frames) {
+    struct ct_cbuf_mpsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_mpsc_init(&circular_buffer, 1), 0);
+
+    void* first = ct_cbuf_mpsc_reserve(&circular_buffer, 10);
+    void* second = ct_cbuf_mpsc_reserve(&circular_buffer, 20);
+    EXPECT_NE(first, nullptr);
+    EXPECT_NE(second, nullptr);
+
+    // The second frame is committed first, but must not be read before the first one
+    unsigned int frames = 0;
+    ct_cbuf_mpsc_commit(&circular_buffer, second);
+    EXPECT_EQ(ct_cbuf_mpsc_read(&circular_buffer, count_frame, &frames, 64), 0u);
+
+    ct_cbuf_mpsc_commit(&circular_buffer, first);
+    EXPECT_EQ(ct_cbuf_mpsc_read(&circular_buffer, count_frame, &frames, 64), 2u);
+    EXPECT_EQ(frames, 2u);
+
+    // Frames larger than the whole buffer are rejected, and so are frames that do not fit right now
+    EXPECT_EQ(ct_cbuf_mpsc_reserve(&circular_buffer, circular_buffer.ring.capacity), nullptr);
+    EXPECT_NE(ct_cbuf_mpsc_reserve(&circular_buffer, circular_buffer.ring.capacity / 2), nullptr);
+    EXPECT_EQ(ct_cbuf_mpsc_reserve(&circular_buffer, circular_buffer.ring.capacity / 2), nullptr);
+
+    ct_cbuf_mpsc_exit(&circular_buffer);
+}
+
+TEST(cbuf_mpsc, oversized_frames_are_rejected) {
+    struct ct_cbuf_mpsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_mpsc_init(&circular_buffer, 1), 0);
+
+    // Lengths whose rounded frame size would wrap around
+    EXPECT_EQ(ct_cbuf_mpsc_reserve(&circular_buffer, UINT32_MAX), nullptr);
+    EXPECT_EQ(ct_cbuf_mpsc_reserve(&circular_buffer, 0xFFFFFFFC), nullptr);
+    EXPECT_EQ(ct_cbuf_mpsc_write(&circular_buffer, "", 0xFFFFFFF9), -1);
+
+    // A frame that takes up the whole buffer, header included, still fits
+    const uint32_t largest = circular_buffer.ring.capacity - 8;
+    EXPECT_EQ(ct_cbuf_mpsc_reserve(&circular_buffer, largest + 1), nullptr);
+    EXPECT_NE(ct_cbuf_mpsc_reserve(&circular_buffer, largest), nullptr);
+
+    ct_cbuf_mpsc_exit(&circular_buffer);
+}
+
+static void collect_frame(void* context, const void* payload, uint32_t) {
+    unsigned int sequence;
+    memcpy(&sequence, payload, sizeof(sequence));
+    ((std::vector<unsigned int>*) context)->push_back(sequence);
+}
+
+TEST(cbuf_mpsc, a_full_buffer_is_read_exactly_once) {
+    struct ct_cbuf_mpsc circular_buffer;
+    EXPECT_EQ(ct_cbuf_mpsc_init(&circular_buffer, 1), 0);
+
+    // Frames of 64 bytes, header included, fill the buffer up to the last byte
+    const uint32_t length = 64 - 8;
+    const unsigned int frame_count = circular_buffer.ring.capacity / 64;
+
+    for (int round = 0; round < 3; round++) {
+        unsigned char payload[length] = {};
+        for (unsigned int i = 0; i < frame_count; i++) {
+            memcpy(payload, &i, sizeof(i));
+            EXPECT_EQ(ct_cbuf_mpsc_write(&circular_buffer, payload, length), 0);
+        }
+        EXPECT_EQ(circular_buffer.head - circular_buffer.tail, circular_buffer.ring.capacity);
+        EXPECT_EQ(ct_cbuf_mpsc_write(&circular_buffer, payload, 0), -1);
+
+        // Asking for more frames than there are must return each of them once
+        std::vector<unsigned int> sequences;
+        EXPECT_EQ(ct_cbuf_mpsc_read(&circular_buffer, collect_frame, &sequences, 1000), frame_count);
+        ASSERT_EQ(sequences.size(), frame_count);
+        for (unsigned int i = 0; i < frame_count; i++)
+            EXPECT_EQ(sequences[i], i);
+
+        EXPECT_EQ(circular_buffer.head, circular_buffer.tail);
+    }
+
+    ct_cbuf_mpsc_exit(&circular_buffer);
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <vector>
+
+extern "C" {
+    #include "ctools/cbuf_pool.h"
+}
+
+TEST(cbuf_pool, acquire_and_release) {
+    const unsigned int count = 8;
+
+    struct ct_cbuf_pool pool;
+    EXPECT_EQ(ct_cbuf_pool_init(&pool, count, 5000, 0), 0);
+
+    std::vector<struct ct_cbuf*> cbufs;
+    for (unsigned int i = 0; i < count; i++) {
+        struct ct_cbuf* cbuf = ct_cbuf_pool_acquire(&pool);
+        ASSERT_NE(cbuf, nullptr);
+        EXPECT_GE(cbuf->capacity, 5000u);
+        EXPECT_EQ(ct_cbuf_space_occupied(cbuf), 0u);
+        cbufs.push_back(cbuf);
+    }
+
+    // All buffers are in use
+    EXPECT_EQ(ct_cbuf_pool_acquire(&pool), nullptr);
+
+    struct ct_cbuf_pool_stats stats;
+    ct_cbuf_pool_stats(&pool, &stats);
+    EXPECT_EQ(stats.count, count);
+    EXPECT_EQ(stats.in_use, count);
+    EXPECT_EQ(stats.high_water, count);
+
+    // Each buffer wraps around on its own, without touching its neighbours
+    const unsigned int capacity = cbufs[0]->capacity;
+    std::vector<unsigned char> pattern(capacity), sink(capacity);
+
+    for (unsigned int i = 0; i < count; i++) {
+        for (unsigned int j = 0; j < capacity; j++)
+            pattern[j] = i * 31 + j;
+
+        EXPECT_EQ(ct_cbuf_write(cbufs[i], pattern.data(), capacity - 100), capacity - 100);
+        EXPECT_EQ(ct_cbuf_read(cbufs[i], sink.data(), capacity - 100), capacity - 100);
+        EXPECT_EQ(ct_cbuf_write(cbufs[i], pattern.data(), capacity), capacity);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        for (unsigned int j = 0; j < capacity; j++)
+            pattern[j] = i * 31 + j;
+
+        EXPECT_EQ(ct_cbuf_read(cbufs[i], sink.data(), capacity), capacity);
+        EXPECT_EQ(memcmp(pattern.data(), sink.data(), capacity), 0);
+    }
+
+    // Pooled buffers cannot change their capacity
+    EXPECT_EQ(ct_cbuf_grow(cbufs[0], capacity * 2), -1);
+    EXPECT_EQ(errno, EPERM);
+    EXPECT_EQ(ct_cbuf_shrink(cbufs[0], 1), -1);
+    EXPECT_EQ(errno, EPERM);
+
+    // Release half of them, and take one back
+    for (unsigned int i = 0; i < count / 2; i++)
+        EXPECT_EQ(ct_cbuf_pool_release(&pool, cbufs[i]), 0);
+
+    // A buffer can only be released once, and only to its own pool
+    EXPECT_EQ(ct_cbuf_pool_release(&pool, cbufs[0]), -1);
+    struct ct_cbuf foreign;
+    EXPECT_EQ(ct_cbuf_pool_release(&pool, &foreign), -1);
+
+    struct ct_cbuf* cbuf = ct_cbuf_pool_acquire(&pool);
+    ASSERT_NE(cbuf, nullptr);
+    EXPECT_EQ(ct_cbuf_space_occupied(cbuf), 0u);
+
+    ct_cbuf_pool_stats(&pool, &stats);
+    EXPECT_EQ(stats.in_use, count / 2 + 1);
+    EXPECT_EQ(stats.high_water, count);
+
+    ct_cbuf_pool_exit(&pool);
+}
+
+static void expect_cleared_on_release(const int flags) {
+    struct ct_cbuf_pool pool;
+    EXPECT_EQ(ct_cbuf_pool_init(&pool, 1, 1, flags), 0);
+
+    struct ct_cbuf* cbuf = ct_cbuf_pool_acquire(&pool);
+    ASSERT_NE(cbuf, nullptr);
+
+    const unsigned int capacity = cbuf->capacity;
+    std::vector<unsigned char> data(capacity, 0xAB);
+    EXPECT_EQ(ct_cbuf_write(cbuf, data.data(), capacity), capacity);
+
+    EXPECT_EQ(ct_cbuf_pool_release(&pool, cbuf), 0);
+    cbuf = ct_cbuf_pool_acquire(&pool);
+    ASSERT_NE(cbuf, nullptr);
+
+    // Both halves of the mapping read as zeroes
+    const unsigned char* bytes = (const unsigned char*) cbuf->buffer;
+    unsigned int non_zero = 0;
+    for (unsigned int i = 0; i < capacity * 2; i++)
+        non_zero += bytes[i] != 0;
+
+    EXPECT_EQ(non_zero, 0u);
+
+    ct_cbuf_pool_exit(&pool);
+}
+
+TEST(cbuf_pool, zero_on_release) {
+    expect_cleared_on_release(CT_CBUF_POOL_ZERO);
+}
+
+TEST(cbuf_pool, discard_on_release) {
+    expect_cleared_on_release(CT_CBUF_POOL_DISCARD);
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#define DEQUE_NAME deque
+#define DEQUE_TYPE int
+extern "C" {
+    #include "ctools/deque.h"
+}
+
+TEST(deque, owner_pops_in_lifo_order) {
+    deque d;
+    EXPECT_EQ(deque_create(&d, 0), 0);
+
+    // Enough values to grow the array a few times
+    const int NUM_VALUES = 1000;
+
+    for (int i = 0; i < NUM_VALUES; i++)
+        EXPECT_EQ(deque_push(&d, i), 0);
+
+    EXPECT_EQ(deque_size(&d), NUM_VALUES);
+
+    int value;
+    for (int i = NUM_VALUES - 1; i >= 0; i--) {
+        EXPECT_EQ(deque_pop(&d, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    EXPECT_EQ(deque_pop(&d, &value), -1);
+    EXPECT_EQ(deque_size(&d), 0);
+
+    deque_destroy(&d);
+}
+
+TEST(deque, thieves_steal_in_fifo_order) {
+    deque d;
+    EXPECT_EQ(deque_create(&d, 0), 0);
+
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(deque_push(&d, i), 0);
+
+    int value;
+    for (int i = 0; i < 50; i++) {
+        EXPECT_EQ(deque_steal(&d, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    // Both ends meet in the middle
+    for (int i = 99; i >= 50; i--) {
+        EXPECT_EQ(deque_pop(&d, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    EXPECT_EQ(deque_steal(&d, &value), -1);
+    EXPECT_EQ(deque_pop(&d, &value), -1);
+
+    // The indices keep running after the deque has been emptied
+    EXPECT_EQ(deque_push(&d, 7), 0);
+    EXPECT_EQ(deque_steal(&d, &value), 0);
+    EXPECT_EQ(value, 7);
+
+    deque_destroy(&d);
+}
+
+TEST(deque, every_value_is_taken_once) {
+    deque d;
+    EXPECT_EQ(deque_create(&d, 0), 0);
+
+    const int THIEF_COUNT = 8;
+    const int NUM_VALUES = 200000;
+
+    std::vector<std::vector<int>> stolen(THIEF_COUNT);
+    std::vector<int> popped;
+    std::vector<std::thread> thieves;
+    bool done = false;
+
+    for (int t = 0; t < THIEF_COUNT; t++) {
+        thieves.emplace_back([&, t](){
+            int value;
+            while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE) || deque_size(&d)) {
+                if (deque_steal(&d, &value) == 0)
+                    stolen[t].push_back(value);
+            }
+        });
+    }
+
+    // The owner keeps some of its own work, and leaves the rest to the thieves
+    int value;
+    for (int i = 0; i < NUM_VALUES; i++) {
+        EXPECT_EQ(deque_push(&d, i), 0);
+
+        if (i % 3 == 0 && deque_pop(&d, &value) == 0)
+            popped.push_back(value);
+    }
+
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+
+    for (std::thread& thief : thieves)
+        thief.join();
+
+    std::vector<int> all(popped);
+    for (const std::vector<int>& values : stolen)
+        all.insert(all.end(), values.begin(), values.end());
+
+    std::sort(all.begin(), all.end());
+
+    ASSERT_EQ(all.size(), (size_t) NUM_VALUES);
+    for (int i = 0; i < NUM_VALUES; i++)
+        EXPECT_EQ(all[i], i);
+
+    deque_destroy(&d);
+}
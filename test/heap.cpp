@@ -8,6 +8,16 @@
 extern "C" {
     #include "ctools/heap.h"
 }
+#undef HEAP_NAME
+
+// An inline capacity that the includer picked for their own stacks must survive heap.h
+#define HEAP_NAME small_heap
+#define STACK_INLINE_CAPACITY 8
+extern "C" {
+    #include "ctools/heap.h"
+}
+static_assert(STACK_INLINE_CAPACITY == 8, "heap.h must not change STACK_INLINE_CAPACITY");
+#undef STACK_INLINE_CAPACITY
 
 TEST(heap_verify, base_case) {
     const int heap_array[] = { 9, 8, 7, 6, 5, 4, 3, 2, 1 };
@@ -53,6 +63,16 @@ TEST(heap_build, even_array_size) {
     EXPECT_EQ(heap_verify(heap_array, 9), 0);
 }
 
+TEST(heap_build, stack_with_the_includers_inline_capacity) {
+    int heap_array[100];
+    for (int i = 0; i < 100; i++)
+        heap_array[i] = i;
+
+    small_heap_build(heap_array, 100);
+
+    EXPECT_EQ(small_heap_verify(heap_array, 100), 0u);
+}
+
 TEST(heap, heap_sort_case_100k_nodes) {
     heap* h = heap_create(16);
 
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <chrono>
+
+extern "C" {
+    #include "ctools/pool.h"
+    #include <errno.h>
+}
+
+static void wait_until_idle(ct_pool* pool) {
+    while (ct_pool_pending(pool))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void count(void* arg) {
+    __atomic_add_fetch((int*) arg, 1, __ATOMIC_RELAXED);
+}
+
+TEST(pool, runs_every_submitted_task) {
+    ct_pool pool;
+    ASSERT_EQ(ct_pool_init(&pool, 4), 0);
+
+    int counter = 0;
+    for (int i = 0; i < 10000; i++)
+        EXPECT_EQ(ct_pool_submit(&pool, count, &counter), 0);
+
+    wait_until_idle(&pool);
+    EXPECT_EQ(__atomic_load_n(&counter, __ATOMIC_RELAXED), 10000);
+
+    ct_pool_exit(&pool);
+}
+
+struct fork_join {
+    ct_pool* pool;
+    int depth;
+    int* leaves;
+};
+
+// Spawns a binary tree of tasks from inside the pool, which the workers spread out by stealing
+static void fork(void* arg) {
+    fork_join* task = (fork_join*) arg;
+
+    if (task->depth == 0) {
+        __atomic_add_fetch(task->leaves, 1, __ATOMIC_RELAXED);
+    } else {
+        for (int i = 0; i < 2; i++) {
+            fork_join* child = new fork_join { task->pool, task->depth - 1, task->leaves };
+            EXPECT_EQ(ct_pool_submit(task->pool, fork, child), 0);
+        }
+    }
+
+    delete task;
+}
+
+TEST(pool, tasks_spawn_tasks) {
+    ct_pool pool;
+    ASSERT_EQ(ct_pool_init(&pool, 0), 0);
+
+    int leaves = 0;
+    EXPECT_EQ(ct_pool_submit(&pool, fork, new fork_join { &pool, 14, &leaves }), 0);
+
+    wait_until_idle(&pool);
+    EXPECT_EQ(__atomic_load_n(&leaves, __ATOMIC_RELAXED), 1 << 14);
+
+    ct_pool_exit(&pool);
+}
+
+struct timestamp {
+    std::chrono::steady_clock::time_point time;
+    int order;
+    int* next_order;
+};
+
+static void stamp(void* arg) {
+    timestamp* t = (timestamp*) arg;
+    t->time = std::chrono::steady_clock::now();
+    t->order = __atomic_fetch_add(t->next_order, 1, __ATOMIC_RELAXED);
+}
+
+TEST(pool, delayed_tasks_run_in_deadline_order) {
+    ct_pool pool;
+    ASSERT_EQ(ct_pool_init(&pool, 2), 0);
+
+    int next_order = 0;
+    timestamp late = { {}, -1, &next_order };
+    timestamp early = { {}, -1, &next_order };
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(ct_pool_submit_delayed(&pool, stamp, &late, 60), 0);
+    EXPECT_EQ(ct_pool_submit_delayed(&pool, stamp, &early, 20), 0);
+
+    wait_until_idle(&pool);
+
+    EXPECT_EQ(early.order, 0);
+    EXPECT_EQ(late.order, 1);
+    EXPECT_GE(early.time - start, std::chrono::milliseconds(20));
+    EXPECT_GE(late.time - start, std::chrono::milliseconds(60));
+
+    ct_pool_exit(&pool);
+}
+
+TEST(pool, shutdown_finishes_queued_tasks_and_rejects_new_ones) {
+    ct_pool pool;
+    ASSERT_EQ(ct_pool_init(&pool, 2), 0);
+
+    int counter = 0;
+    for (int i = 0; i < 1000; i++)
+        EXPECT_EQ(ct_pool_submit(&pool, count, &counter), 0);
+
+    // Never due before the pool is gone
+    EXPECT_EQ(ct_pool_submit_delayed(&pool, count, &counter, 60000), 0);
+
+    ct_pool_shutdown(&pool);
+
+    EXPECT_EQ(ct_pool_submit(&pool, count, &counter), -1);
+    EXPECT_EQ(errno, ECANCELED);
+    EXPECT_EQ(ct_pool_submit_delayed(&pool, count, &counter, 0), -1);
+    EXPECT_EQ(errno, ECANCELED);
+
+    ct_pool_exit(&pool);
+
+    EXPECT_EQ(counter, 1000);
+}
+
+struct gate {
+    int started;
+    int open;
+};
+
+static void wait_at_gate(void* arg) {
+    struct gate* g = (struct gate*) arg;
+    __atomic_store_n(&g->started, 1, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&g->open, __ATOMIC_ACQUIRE))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+TEST(pool, shutdown_runs_delayed_tasks_that_are_already_due) {
+    ct_pool pool;
+    ASSERT_EQ(ct_pool_init(&pool, 1), 0);
+
+    // Keep the only worker busy, so it cannot notice that the delayed task is due
+    struct gate g = { 0, 0 };
+    int counter = 0;
+    EXPECT_EQ(ct_pool_submit(&pool, wait_at_gate, &g), 0);
+    while (!__atomic_load_n(&g.started, __ATOMIC_ACQUIRE))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    EXPECT_EQ(ct_pool_submit_delayed(&pool, count, &counter, 0), 0);
+
+    ct_pool_shutdown(&pool);
+    __atomic_store_n(&g.open, 1, __ATOMIC_RELEASE);
+
+    ct_pool_exit(&pool);
+
+    EXPECT_EQ(counter, 1);
+}
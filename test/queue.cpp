@@ -19,6 +19,15 @@ extern "C" {
     #include <errno.h>
 }
 
+#undef QUEUE_NAME
+#undef QUEUE_INDEX
+#define QUEUE_NAME growable_queue
+#define QUEUE_INDEX unsigned char
+#define QUEUE_EXT_GROWABLE
+extern "C" {
+    #include "ctools/queue.h"
+}
+
 
 
 TEST(queue, mask_is_created_correctly) {
@@ -162,3 +171,110 @@ TEST(queue, size_reports_correctly) {
     
     queue_destroy(q);
 }
+
+
+
+TEST(queue, capacity_reports_the_usable_slots) {
+    queue* q = queue_create(8);
+    EXPECT_EQ(queue_capacity(q), 15);
+    queue_destroy(q);
+}
+
+
+
+// Fills a growable queue that wraps around at `offset`, and checks that it keeps its order while growing
+static void grow_wrapped_queue(const int offset, const int count) {
+    growable_queue* q = growable_queue_create(7);
+    int value;
+
+    for (int i = 0; i < offset; i++) {
+        EXPECT_EQ(growable_queue_push(q, -1), 0);
+        EXPECT_EQ(growable_queue_pop(q, &value), 0);
+    }
+
+    for (int i = 0; i < count; i++)
+        EXPECT_EQ(growable_queue_push(q, i), 0);
+
+    EXPECT_EQ(growable_queue_size(q), count);
+
+    for (int i = 0; i < count; i++) {
+        EXPECT_EQ(growable_queue_pop(q, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    EXPECT_EQ(growable_queue_pop(q, &value), -1);
+
+    growable_queue_destroy(q);
+}
+
+TEST(queue, growable_queue_keeps_its_order) {
+    // No wrap-around, a short run before the wrap point, and a short run after it
+    grow_wrapped_queue(0, 100);
+    grow_wrapped_queue(6, 100);
+    grow_wrapped_queue(2, 100);
+}
+
+TEST(queue, growable_queue_stops_at_the_max_size) {
+    growable_queue* q = growable_queue_create(1);
+
+    for (int i = 0; i < growable_queue_max_size - 1; i++)
+        EXPECT_EQ(growable_queue_push(q, i), 0);
+
+    EXPECT_EQ(growable_queue_capacity(q), growable_queue_max_size - 1);
+    EXPECT_EQ(growable_queue_push(q, 0), -1);
+
+    growable_queue_destroy(q);
+}
+
+TEST(queue, push_n_and_pop_n_wrap_around_and_report_partial_counts) {
+    queue* q = queue_create(7);
+    int values[10], out[10];
+    for (int i = 0; i < 10; i++)
+        values[i] = i;
+
+    // Move the front close to the end of the array, so the batches wrap
+    EXPECT_EQ(queue_push_n(q, values, 5), 5);
+    EXPECT_EQ(queue_pop_n(q, out, 5), 5);
+
+    // Only 7 of the 10 fit
+    EXPECT_EQ(queue_push_n(q, values, 10), 7);
+    EXPECT_TRUE(queue_is_full(q));
+    EXPECT_EQ(queue_push_n(q, values, 10), 0);
+
+    EXPECT_EQ(queue_pop_n(q, out, 3), 3);
+    EXPECT_EQ(queue_pop_n(q, &out[3], 10), 4);
+    for (int i = 0; i < 7; i++)
+        EXPECT_EQ(out[i], i);
+
+    EXPECT_EQ(queue_pop_n(q, out, 10), 0);
+    EXPECT_TRUE(queue_is_empty(q));
+
+    queue_destroy(q);
+}
+
+TEST(queue, growable_queue_push_n_grows_to_fit) {
+    growable_queue* q = growable_queue_create(7);
+    int values[100], out[100], value;
+    for (int i = 0; i < 100; i++)
+        values[i] = i;
+
+    // Wrap the elements around the end of the array before growing
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(growable_queue_push(q, -1), 0);
+        EXPECT_EQ(growable_queue_pop(q, &value), 0);
+    }
+
+    EXPECT_EQ(growable_queue_push_n(q, values, 6), 6);
+    EXPECT_EQ(growable_queue_push_n(q, &values[6], 94), 94);
+    EXPECT_EQ(growable_queue_size(q), 100);
+
+    EXPECT_EQ(growable_queue_pop_n(q, out, 100), 100);
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(out[i], i);
+
+    // Stops at the max size, and reports what did fit
+    EXPECT_EQ(growable_queue_push_n(q, values, 100), 100);
+    EXPECT_EQ(growable_queue_push_n(q, values, 100), growable_queue_max_size - 1 - 100);
+
+    growable_queue_destroy(q);
+}
@@ -0,0 +1,388 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#define QUEUE_NAME spsc_queue
+#define QUEUE_TYPE int
+#define QUEUE_EXT_SPSC
+extern "C" {
+    #include "ctools/queue.h"
+}
+#undef QUEUE_NAME
+#undef QUEUE_EXT_SPSC
+
+#define QUEUE_NAME mpmc_queue
+#define QUEUE_EXT_MPMC
+extern "C" {
+    #include "ctools/queue.h"
+}
+#undef QUEUE_NAME
+#undef QUEUE_EXT_MPMC
+
+#define QUEUE_NAME blocking_queue
+#define QUEUE_EXT_BLOCKING
+extern "C" {
+    #include "ctools/queue.h"
+    #include <sys/epoll.h>
+}
+
+// Whether the eventfd of the queue is readable, according to epoll
+static bool fd_is_readable(const int epoll_fd) {
+    struct epoll_event event;
+    return epoll_wait(epoll_fd, &event, 1, 0) == 1;
+}
+
+TEST(queue_concurrency, spsc_queue_behaves_like_a_queue_on_one_thread) {
+    spsc_queue* q = spsc_queue_create(3);
+    int value;
+
+    EXPECT_TRUE(spsc_queue_is_empty(q));
+    EXPECT_EQ(spsc_queue_pop(q, &value), -1);
+
+    for (int i = 0; i < 3; i++)
+        EXPECT_EQ(spsc_queue_push(q, i), 0);
+
+    EXPECT_TRUE(spsc_queue_is_full(q));
+    EXPECT_EQ(spsc_queue_push(q, 3), -1);
+    EXPECT_EQ(spsc_queue_size(q), 3u);
+
+    spsc_queue_peek(q, &value);
+    EXPECT_EQ(value, 0);
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(spsc_queue_pop(q, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    EXPECT_EQ(spsc_queue_pop(q, &value), -1);
+
+    spsc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, spsc_queue_hands_over_every_element_in_order) {
+    // A small queue, so both sides keep running into the full and empty cases
+    spsc_queue* q = spsc_queue_create(15);
+
+    const int NUM_VALUES = 1000000;
+
+    std::thread producer([q](){
+        for (int i = 0; i < NUM_VALUES; i++)
+            while (spsc_queue_push(q, i))
+                std::this_thread::yield();
+    });
+
+    int value;
+    for (int i = 0; i < NUM_VALUES; i++) {
+        while (spsc_queue_pop(q, &value))
+            std::this_thread::yield();
+
+        ASSERT_EQ(value, i);
+    }
+
+    producer.join();
+
+    EXPECT_TRUE(spsc_queue_is_empty(q));
+
+    spsc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, spsc_queue_hands_over_batches_in_order) {
+    spsc_queue* q = spsc_queue_create(15);
+
+    const int NUM_VALUES = 1000000;
+    const unsigned int BATCH = 7;
+
+    std::thread producer([q](){
+        int values[BATCH];
+        int next = 0;
+
+        while (next < NUM_VALUES) {
+            unsigned int count = 0;
+            for (; count < BATCH && next + (int) count < NUM_VALUES; count++)
+                values[count] = next + count;
+
+            // Push the rest of a partially pushed batch on the next round
+            const unsigned int pushed = spsc_queue_push_n(q, values, count);
+            if (!pushed)
+                std::this_thread::yield();
+
+            next += pushed;
+        }
+    });
+
+    int values[BATCH];
+    int expected = 0;
+    while (expected < NUM_VALUES) {
+        const unsigned int popped = spsc_queue_pop_n(q, values, BATCH);
+        if (!popped)
+            std::this_thread::yield();
+
+        for (unsigned int i = 0; i < popped; i++)
+            ASSERT_EQ(values[i], expected++);
+    }
+
+    producer.join();
+
+    EXPECT_TRUE(spsc_queue_is_empty(q));
+
+    spsc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, mpmc_queue_push_n_and_pop_n_report_partial_counts) {
+    mpmc_queue* q = mpmc_queue_create(7);
+    int values[10], out[10];
+    for (int i = 0; i < 10; i++)
+        values[i] = i;
+
+    EXPECT_EQ(mpmc_queue_push_n(q, values, 10), 8u);
+    EXPECT_EQ(mpmc_queue_pop_n(q, out, 10), 8u);
+    for (int i = 0; i < 8; i++)
+        EXPECT_EQ(out[i], i);
+
+    EXPECT_EQ(mpmc_queue_pop_n(q, out, 10), 0u);
+
+    mpmc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, mpmc_queue_behaves_like_a_queue_on_one_thread) {
+    mpmc_queue* q = mpmc_queue_create(7);
+    int value;
+
+    // Every slot can be used
+    EXPECT_EQ(mpmc_queue_capacity(q), 8u);
+    EXPECT_TRUE(mpmc_queue_is_empty(q));
+    EXPECT_EQ(mpmc_queue_pop(q, &value), -1);
+
+    // Go around the ring a few times
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 8; i++)
+            EXPECT_EQ(mpmc_queue_push(q, i), 0);
+
+        EXPECT_TRUE(mpmc_queue_is_full(q));
+        EXPECT_EQ(mpmc_queue_push(q, 8), -1);
+        EXPECT_EQ(mpmc_queue_size(q), 8u);
+
+        for (int i = 0; i < 8; i++) {
+            EXPECT_EQ(mpmc_queue_pop(q, &value), 0);
+            EXPECT_EQ(value, i);
+        }
+
+        EXPECT_EQ(mpmc_queue_pop(q, &value), -1);
+    }
+
+    mpmc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, mpmc_queue_has_at_least_two_slots) {
+    mpmc_queue* q = mpmc_queue_create(0);
+    int value;
+
+    EXPECT_EQ(mpmc_queue_capacity(q), 2u);
+    EXPECT_EQ(mpmc_queue_push(q, 1), 0);
+    EXPECT_EQ(mpmc_queue_push(q, 2), 0);
+    EXPECT_EQ(mpmc_queue_push(q, 3), -1);
+
+    EXPECT_EQ(mpmc_queue_pop(q, &value), 0);
+    EXPECT_EQ(value, 1);
+    EXPECT_EQ(mpmc_queue_pop(q, &value), 0);
+    EXPECT_EQ(value, 2);
+    EXPECT_EQ(mpmc_queue_pop(q, &value), -1);
+
+    mpmc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, mpmc_queue_hands_over_every_element_once) {
+    mpmc_queue* q = mpmc_queue_create(63);
+
+    const int PRODUCER_COUNT = 4;
+    const int CONSUMER_COUNT = 4;
+    const int VALUES_PER_PRODUCER = 100000;
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int>> consumed(CONSUMER_COUNT);
+    int remaining = PRODUCER_COUNT * VALUES_PER_PRODUCER;
+
+    for (int p = 0; p < PRODUCER_COUNT; p++) {
+        threads.emplace_back([q, p](){
+            for (int i = 0; i < VALUES_PER_PRODUCER; i++)
+                while (mpmc_queue_push(q, p * VALUES_PER_PRODUCER + i))
+                    std::this_thread::yield();
+        });
+    }
+
+    for (int c = 0; c < CONSUMER_COUNT; c++) {
+        threads.emplace_back([&, c](){
+            int value, last_seen[PRODUCER_COUNT];
+            std::fill(last_seen, last_seen + PRODUCER_COUNT, -1);
+
+            while (__atomic_load_n(&remaining, __ATOMIC_RELAXED) > 0) {
+                if (mpmc_queue_pop(q, &value)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                // The values of each producer come out in the order they were pushed
+                const int producer = value / VALUES_PER_PRODUCER;
+                EXPECT_GT(value, last_seen[producer]);
+                last_seen[producer] = value;
+
+                consumed[c].push_back(value);
+                __atomic_sub_fetch(&remaining, 1, __ATOMIC_RELAXED);
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::vector<int> all;
+    for (const std::vector<int>& values : consumed)
+        all.insert(all.end(), values.begin(), values.end());
+
+    std::sort(all.begin(), all.end());
+
+    ASSERT_EQ(all.size(), (size_t) PRODUCER_COUNT * VALUES_PER_PRODUCER);
+    for (int i = 0; i < PRODUCER_COUNT * VALUES_PER_PRODUCER; i++)
+        EXPECT_EQ(all[i], i);
+
+    EXPECT_TRUE(mpmc_queue_is_empty(q));
+
+    mpmc_queue_destroy(q);
+}
+
+TEST(queue_concurrency, blocking_queue_fd_is_readable_while_not_empty) {
+    blocking_queue* q = blocking_queue_create(7);
+    int values[3] = { 1, 2, 3 }, out[3], value;
+
+    const int epoll_fd = epoll_create1(0);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    ASSERT_EQ(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, blocking_queue_fd(q), &event), 0);
+
+    EXPECT_FALSE(fd_is_readable(epoll_fd));
+
+    EXPECT_EQ(blocking_queue_push(q, 0), 0);
+    EXPECT_TRUE(fd_is_readable(epoll_fd));
+    EXPECT_EQ(blocking_queue_push_n(q, values, 3), 3u);
+    EXPECT_TRUE(fd_is_readable(epoll_fd));
+
+    EXPECT_EQ(blocking_queue_pop(q, &value), 0);
+    EXPECT_TRUE(fd_is_readable(epoll_fd));
+    EXPECT_EQ(blocking_queue_pop_n(q, out, 3), 3u);
+    EXPECT_FALSE(fd_is_readable(epoll_fd));
+    EXPECT_EQ(blocking_queue_pop(q, &value), -1);
+
+    // Readable for good once shut down, and every operation is cancelled
+    blocking_queue_shutdown(q);
+    EXPECT_TRUE(fd_is_readable(epoll_fd));
+    EXPECT_EQ(blocking_queue_push(q, 0), -2);
+    EXPECT_EQ(blocking_queue_pop(q, &value), -2);
+    EXPECT_EQ(blocking_queue_push_n(q, values, 3), 0u);
+
+    close(epoll_fd);
+    blocking_queue_destroy(q);
+}
+
+TEST(queue_concurrency, blocking_queue_waits_time_out) {
+    blocking_queue* q = blocking_queue_create(1);
+    int value;
+
+    EXPECT_EQ(blocking_queue_pop_wait(q, &value, 0), -1);
+    EXPECT_EQ(blocking_queue_pop_wait(q, &value, 20), -1);
+
+    EXPECT_EQ(blocking_queue_push_wait(q, 1, 0), 0);
+    EXPECT_EQ(blocking_queue_push_wait(q, 2, 0), -1);
+    EXPECT_EQ(blocking_queue_push_wait(q, 2, 20), -1);
+
+    // Room is made while waiting
+    std::thread consumer([q](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        int value;
+        EXPECT_EQ(blocking_queue_pop(q, &value), 0);
+        EXPECT_EQ(value, 1);
+    });
+
+    EXPECT_EQ(blocking_queue_push_wait(q, 2, 5000), 0);
+    consumer.join();
+
+    EXPECT_EQ(blocking_queue_pop_wait(q, &value, 5000), 0);
+    EXPECT_EQ(value, 2);
+
+    blocking_queue_destroy(q);
+}
+
+TEST(queue_concurrency, blocking_queue_shutdown_wakes_up_waiting_threads) {
+    blocking_queue* q = blocking_queue_create(1);
+    EXPECT_EQ(blocking_queue_push(q, 0), 0);
+
+    std::thread producer([q](){
+        EXPECT_EQ(blocking_queue_push_wait(q, 1, -1), -2);
+    });
+
+    blocking_queue* empty = blocking_queue_create(1);
+
+    std::thread consumer([empty](){
+        int value;
+        EXPECT_EQ(blocking_queue_pop_wait(empty, &value, -1), -2);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    blocking_queue_shutdown(q);
+    blocking_queue_shutdown(empty);
+
+    producer.join();
+    consumer.join();
+
+    blocking_queue_destroy(q);
+    blocking_queue_destroy(empty);
+}
+
+TEST(queue_concurrency, blocking_queue_feeds_an_epoll_loop) {
+    // A small queue, so the producers keep waiting for room
+    blocking_queue* q = blocking_queue_create(15);
+
+    const int PRODUCER_COUNT = 4;
+    const int VALUES_PER_PRODUCER = 50000;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCER_COUNT; p++) {
+        producers.emplace_back([q, p](){
+            for (int i = 0; i < VALUES_PER_PRODUCER; i++)
+                ASSERT_EQ(blocking_queue_push_wait(q, p * VALUES_PER_PRODUCER + i, -1), 0);
+        });
+    }
+
+    const int epoll_fd = epoll_create1(0);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    ASSERT_EQ(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, blocking_queue_fd(q), &event), 0);
+
+    int last_seen[PRODUCER_COUNT];
+    std::fill(last_seen, last_seen + PRODUCER_COUNT, -1);
+
+    // Sleep in epoll_wait, and empty the queue whenever it wakes up
+    int received = 0;
+    while (received < PRODUCER_COUNT * VALUES_PER_PRODUCER) {
+        ASSERT_EQ(epoll_wait(epoll_fd, &event, 1, 5000), 1);
+
+        int value;
+        while (blocking_queue_pop(q, &value) == 0) {
+            // The values of each producer come out in the order they were pushed
+            const int producer = value / VALUES_PER_PRODUCER;
+            ASSERT_GT(value, last_seen[producer]);
+            last_seen[producer] = value;
+
+            received++;
+        }
+    }
+
+    for (std::thread& producer : producers)
+        producer.join();
+
+    EXPECT_FALSE(fd_is_readable(epoll_fd));
+
+    close(epoll_fd);
+    blocking_queue_destroy(q);
+}
@@ -5,6 +5,22 @@
 extern "C" {
     #include "ctools/stack.h"
 }
+#undef STACK_NAME
+
+#define STACK_NAME small_stack
+#define STACK_INLINE_CAPACITY 16
+extern "C" {
+    #include "ctools/stack.h"
+}
+#undef STACK_NAME
+#undef STACK_INLINE_CAPACITY
+
+// Smaller than STACK_MIN_CAPACITY
+#define STACK_NAME tiny_stack
+#define STACK_INLINE_CAPACITY 4
+extern "C" {
+    #include "ctools/stack.h"
+}
 
 TEST(stack, elements_are_popped_in_the_correct_order) {
     stack s;
@@ -28,3 +44,112 @@ TEST(stack, elements_are_popped_in_the_correct_order) {
     // Cleanup
     stack_destroy(&s);
 }
+
+TEST(stack, batches_are_pushed_and_popped_in_order) {
+    stack s;
+    stack_create(&s, 0);
+
+    // Large enough to grow the array several times over in one go
+    const int NUM_VALUES = 1000;
+    int values[NUM_VALUES], actual[NUM_VALUES];
+
+    for (int i = 0; i < NUM_VALUES; i++)
+        values[i] = i;
+
+    EXPECT_EQ(stack_push_n(&s, values, NUM_VALUES), 0);
+    EXPECT_EQ(stack_size(&s), (unsigned int) NUM_VALUES);
+
+    // The last value pushed is on top
+    int top;
+    EXPECT_EQ(stack_pop(&s, &top), 0);
+    EXPECT_EQ(top, NUM_VALUES - 1);
+    EXPECT_EQ(stack_push(&s, top), 0);
+
+    // A batch comes out in the order it went in
+    EXPECT_EQ(stack_pop_n(&s, actual, 10), 10);
+    for (int i = 0; i < 10; i++)
+        EXPECT_EQ(actual[i], NUM_VALUES - 10 + i);
+
+    // Asking for more than there is pops what is left
+    EXPECT_EQ(stack_pop_n(&s, actual, NUM_VALUES), NUM_VALUES - 10);
+    for (int i = 0; i < NUM_VALUES - 10; i++)
+        EXPECT_EQ(actual[i], i);
+
+    EXPECT_EQ(stack_pop_n(&s, actual, NUM_VALUES), 0);
+    EXPECT_EQ(stack_size(&s), 0u);
+
+    // The array shrank back, and still works
+    EXPECT_EQ(s.capacity, (unsigned int) STACK_MIN_CAPACITY);
+    EXPECT_EQ(stack_push_n(&s, values, 3), 0);
+    EXPECT_EQ(stack_pop_n(&s, actual, 3), 3);
+    EXPECT_EQ(memcmp(values, actual, 3 * sizeof(int)), 0);
+
+    // Cleanup
+    stack_destroy(&s);
+}
+
+TEST(stack, inline_capacity_spills_to_the_heap_and_back) {
+    small_stack s;
+    small_stack_create(&s, 0);
+
+    // The first elements stay inside the struct
+    for (int i = 0; i < 16; i++)
+        EXPECT_EQ(small_stack_push(&s, i), 0);
+    EXPECT_EQ(s.array, s.inline_array);
+
+    for (int i = 16; i < 100; i++)
+        EXPECT_EQ(small_stack_push(&s, i), 0);
+    EXPECT_NE(s.array, s.inline_array);
+
+    int value;
+    for (int i = 99; i >= 8; i--) {
+        EXPECT_EQ(small_stack_pop(&s, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    // Shrinking far enough moves the elements back
+    EXPECT_EQ(s.array, s.inline_array);
+    EXPECT_EQ(s.capacity, 16u);
+
+    int values[8];
+    EXPECT_EQ(small_stack_pop_n(&s, values, 10), 8);
+    for (int i = 0; i < 8; i++)
+        EXPECT_EQ(values[i], i);
+
+    small_stack_destroy(&s);
+
+    // Asking for more up front goes straight to the heap
+    small_stack_create(&s, 1000);
+    EXPECT_NE(s.array, s.inline_array);
+    EXPECT_EQ(s.capacity, 1000u);
+    small_stack_destroy(&s);
+}
+
+TEST(stack, inline_capacity_below_the_minimum_capacity_is_used) {
+    tiny_stack s;
+
+    // The inline array is used even though it is smaller than STACK_MIN_CAPACITY
+    tiny_stack_create(&s, 0);
+    EXPECT_EQ(s.array, s.inline_array);
+    EXPECT_EQ(s.capacity, 4u);
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(tiny_stack_push(&s, i), 0);
+    EXPECT_EQ(s.array, s.inline_array);
+
+    // Going past it spills to the heap
+    EXPECT_EQ(tiny_stack_push(&s, 4), 0);
+    EXPECT_NE(s.array, s.inline_array);
+
+    for (int i = 4; i >= 0; i--) {
+        int value;
+        EXPECT_EQ(tiny_stack_pop(&s, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+    tiny_stack_destroy(&s);
+
+    // Asking for more up front goes straight to the heap
+    tiny_stack_create(&s, 10);
+    EXPECT_NE(s.array, s.inline_array);
+    tiny_stack_destroy(&s);
+}
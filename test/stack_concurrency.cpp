@@ -2,10 +2,12 @@
 #include <thread>
 #include <algorithm>
 #include <chrono>
+#include <vector>
 
 #define STACK_NAME stack
 #define STACK_TYPE int
 #define STACK_EXT_THREAD_SAFE
+#define STACK_MAGAZINE_SIZE 16
 extern "C" {
     #include "ctools/stack.h"
 }
@@ -54,3 +56,213 @@ TEST(stack_concurrency, faster_producer) {
 TEST(stack_concurrency, faster_consumer) {
     speed_difference_test(2, 1);
 }
+
+TEST(stack_concurrency, blocking_consumers) {
+    stack s;
+    stack_create(&s, 0);
+
+    const int CONSUMER_COUNT = 4;
+    const int NUMBER_COUNT = 4000;
+    std::vector<int> consumed[CONSUMER_COUNT];
+    std::vector<std::thread> consumers;
+
+    // Consumers sleep until a value arrives, and leave once the stack shuts down
+    for (int c = 0; c < CONSUMER_COUNT; c++) {
+        consumers.emplace_back([&s, &consumed, c](){
+            int value;
+            int res;
+            while ((res = stack_pop_wait(&s, &value, -1)) == 0)
+                consumed[c].push_back(value);
+
+            EXPECT_EQ(res, -2);
+        });
+    }
+
+    for (int i = 0; i < NUMBER_COUNT; i++) {
+        EXPECT_EQ(stack_push(&s, i), 0);
+
+        if (i % 1000 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    // Wait for the consumers to drain the stack, then wake them up for good
+    while (stack_size(&s) != 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    stack_shutdown(&s);
+
+    for (std::thread& consumer : consumers)
+        consumer.join();
+
+    std::vector<int> all;
+    for (int c = 0; c < CONSUMER_COUNT; c++)
+        all.insert(all.end(), consumed[c].begin(), consumed[c].end());
+
+    std::sort(all.begin(), all.end());
+
+    ASSERT_EQ(all.size(), (size_t) NUMBER_COUNT);
+    for (int i = 0; i < NUMBER_COUNT; i++)
+        EXPECT_EQ(all[i], i);
+
+    stack_destroy(&s);
+}
+
+TEST(stack_concurrency, pop_wait_times_out) {
+    stack s;
+    stack_create(&s, 0);
+
+    int value;
+    EXPECT_EQ(stack_pop_wait(&s, &value, 0), -1);
+
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(stack_pop_wait(&s, &value, 20), -1);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+    // A value pushed while waiting ends the wait early
+    std::thread producer([&s](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        stack_push(&s, 42);
+    });
+
+    EXPECT_EQ(stack_pop_wait(&s, &value, 5000), 0);
+    EXPECT_EQ(value, 42);
+
+    producer.join();
+    stack_destroy(&s);
+}
+
+TEST(stack_concurrency, batch_producers_and_consumers) {
+    stack s;
+    stack_create(&s, 0);
+
+    const int PRODUCER_COUNT = 4;
+    const int BATCH_SIZE = 64;
+    const int BATCH_COUNT = 200;
+    const int NUMBER_COUNT = PRODUCER_COUNT * BATCH_COUNT * BATCH_SIZE;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCER_COUNT; p++) {
+        producers.emplace_back([&s, p](){
+            int batch[BATCH_SIZE];
+
+            for (int b = 0; b < BATCH_COUNT; b++) {
+                for (int i = 0; i < BATCH_SIZE; i++)
+                    batch[i] = (p * BATCH_COUNT + b) * BATCH_SIZE + i;
+
+                EXPECT_EQ(stack_push_n(&s, batch, BATCH_SIZE), 0);
+            }
+        });
+    }
+
+    std::vector<int> consumed;
+    std::thread consumer([&s, &consumed](){
+        int batch[BATCH_SIZE];
+
+        while ((int) consumed.size() < NUMBER_COUNT) {
+            const ssize_t count = stack_pop_n(&s, batch, BATCH_SIZE);
+            ASSERT_GE(count, 0);
+            consumed.insert(consumed.end(), batch, batch + count);
+        }
+    });
+
+    for (std::thread& producer : producers)
+        producer.join();
+    consumer.join();
+
+    std::sort(consumed.begin(), consumed.end());
+
+    ASSERT_EQ(consumed.size(), (size_t) NUMBER_COUNT);
+    for (int i = 0; i < NUMBER_COUNT; i++)
+        EXPECT_EQ(consumed[i], i);
+
+    stack_destroy(&s);
+}
+
+TEST(stack_concurrency, magazines_exchange_batches_with_the_shared_stack) {
+    stack s;
+    stack_create(&s, 0);
+
+    stack_magazine m;
+    stack_magazine_init(&m, &s);
+
+    // The magazine absorbs two batches before the shared stack sees anything
+    for (int i = 0; i < 32; i++)
+        EXPECT_EQ(stack_magazine_push(&m, i), 0);
+    EXPECT_EQ(stack_size(&s), 0u);
+
+    // Then the oldest batch moves over as a whole
+    EXPECT_EQ(stack_magazine_push(&m, 32), 0);
+    EXPECT_EQ(stack_size(&s), 16u);
+    EXPECT_EQ(m.count, 17u);
+
+    // Popping drains the magazine first, then refills it with the batch from the shared stack
+    int value;
+    for (int i = 32; i >= 0; i--) {
+        EXPECT_EQ(stack_magazine_pop(&m, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_EQ(stack_magazine_pop(&m, &value), -1);
+
+    EXPECT_EQ(stack_magazine_push(&m, 1), 0);
+    EXPECT_EQ(stack_magazine_flush(&m), 0);
+    EXPECT_EQ(m.count, 0u);
+    EXPECT_EQ(stack_size(&s), 1u);
+
+    stack_destroy(&s);
+}
+
+TEST(stack_concurrency, magazines_recycle_objects_across_threads) {
+    stack s;
+    stack_create(&s, 0);
+
+    // Every thread allocates from and releases to a free list of indices, through its own magazine
+    const int THREAD_COUNT = 8;
+    const int OBJECT_COUNT = 1024;
+
+    for (int i = 0; i < OBJECT_COUNT; i++)
+        stack_push(&s, i);
+
+    std::vector<std::thread> threads;
+    std::vector<int> owners(OBJECT_COUNT, -1);
+
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        threads.emplace_back([&, t](){
+            stack_magazine m;
+            stack_magazine_init(&m, &s);
+
+            std::vector<int> held;
+            for (int round = 0; round < 20000; round++) {
+                int object;
+                if (held.size() < 40 && stack_magazine_pop(&m, &object) == 0) {
+                    // Nobody else may be holding the object
+                    EXPECT_EQ(__atomic_exchange_n(&owners[object], t, __ATOMIC_RELAXED), -1);
+                    held.push_back(object);
+                } else if (!held.empty()) {
+                    __atomic_store_n(&owners[held.back()], -1, __ATOMIC_RELAXED);
+                    EXPECT_EQ(stack_magazine_push(&m, held.back()), 0);
+                    held.pop_back();
+                }
+            }
+
+            for (int object : held) {
+                __atomic_store_n(&owners[object], -1, __ATOMIC_RELAXED);
+                EXPECT_EQ(stack_magazine_push(&m, object), 0);
+            }
+
+            EXPECT_EQ(stack_magazine_flush(&m), 0);
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // Every object is back in the shared stack
+    std::vector<int> all(OBJECT_COUNT);
+    EXPECT_EQ(stack_pop_n(&s, all.data(), OBJECT_COUNT + 1), OBJECT_COUNT);
+
+    std::sort(all.begin(), all.end());
+    for (int i = 0; i < OBJECT_COUNT; i++)
+        EXPECT_EQ(all[i], i);
+
+    stack_destroy(&s);
+}
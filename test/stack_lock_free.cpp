@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#define STACK_NAME lf_stack
+#define STACK_TYPE int
+#define STACK_EXT_LOCK_FREE
+extern "C" {
+    #include "ctools/stack.h"
+}
+#undef STACK_NAME
+
+#define STACK_NAME lf_fixed_stack
+#define STACK_CAPACITY 64
+extern "C" {
+    #include "ctools/stack.h"
+}
+#undef STACK_NAME
+
+#define STACK_NAME lf_shared_stack
+#define STACK_MAGAZINE_SIZE 8
+extern "C" {
+    #include "ctools/stack.h"
+}
+
+TEST(stack_lock_free, elements_are_popped_in_the_correct_order) {
+    lf_stack s;
+    EXPECT_EQ(lf_stack_create(&s, 0), 0);
+
+    // Enough values to grow past the first chunk a few times
+    const int NUM_VALUES = 1000;
+
+    for (int i = NUM_VALUES - 1; i >= 0; i--)
+        EXPECT_EQ(lf_stack_push(&s, i), 0);
+
+    EXPECT_EQ(lf_stack_size(&s), (unsigned int) NUM_VALUES);
+
+    for (int i = 0; i < NUM_VALUES; i++) {
+        int value;
+        EXPECT_EQ(lf_stack_pop(&s, &value), 0);
+        EXPECT_EQ(value, i);
+    }
+
+    int value;
+    EXPECT_EQ(lf_stack_pop(&s, &value), -1);
+
+    // Shutting down cancels both pushing and popping
+    lf_stack_shutdown(&s);
+    EXPECT_EQ(lf_stack_push(&s, 1), -2);
+    EXPECT_EQ(lf_stack_pop(&s, &value), -2);
+
+    lf_stack_destroy(&s);
+}
+
+TEST(stack_lock_free, fixed_capacity_reports_full) {
+    lf_fixed_stack s;
+    EXPECT_EQ(lf_fixed_stack_create(&s), 0);
+
+    for (int i = 0; i < 64; i++)
+        EXPECT_EQ(lf_fixed_stack_push(&s, i), 0);
+
+    EXPECT_EQ(lf_fixed_stack_push(&s, 64), -1);
+
+    int value;
+    EXPECT_EQ(lf_fixed_stack_pop(&s, &value), 0);
+    EXPECT_EQ(value, 63);
+    EXPECT_EQ(lf_fixed_stack_push(&s, 64), 0);
+
+    lf_fixed_stack_destroy(&s);
+}
+
+TEST(stack_lock_free, batches_are_pushed_and_popped_in_order) {
+    lf_fixed_stack s;
+    EXPECT_EQ(lf_fixed_stack_create(&s), 0);
+
+    int values[10], actual[10];
+    for (int i = 0; i < 10; i++)
+        values[i] = i;
+
+    EXPECT_EQ(lf_fixed_stack_push_n(&s, values, 10), 0);
+    EXPECT_EQ(lf_fixed_stack_pop_n(&s, actual, 4), 4);
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(actual[i], 6 + i);
+
+    EXPECT_EQ(lf_fixed_stack_pop_n(&s, actual, 10), 6);
+    EXPECT_EQ(memcmp(values, actual, 6 * sizeof(int)), 0);
+
+    lf_fixed_stack_destroy(&s);
+}
+
+TEST(stack_lock_free, batches_that_do_not_fit_are_not_pushed_at_all) {
+    lf_fixed_stack s;
+    EXPECT_EQ(lf_fixed_stack_create(&s), 0);
+
+    int values[10], value;
+    for (int i = 0; i < 10; i++)
+        values[i] = 100 + i;
+
+    for (int i = 0; i < 60; i++)
+        EXPECT_EQ(lf_fixed_stack_push(&s, i), 0);
+
+    // Only 4 of the 10 would fit
+    EXPECT_EQ(lf_fixed_stack_push_n(&s, values, 10), -1);
+    EXPECT_EQ(lf_fixed_stack_size(&s), 60u);
+
+    // The nodes that were taken went back to the free list
+    EXPECT_EQ(lf_fixed_stack_push_n(&s, values, 4), 0);
+    EXPECT_EQ(lf_fixed_stack_size(&s), 64u);
+
+    for (int i = 3; i >= 0; i--) {
+        EXPECT_EQ(lf_fixed_stack_pop(&s, &value), 0);
+        EXPECT_EQ(value, 100 + i);
+    }
+
+    EXPECT_EQ(lf_fixed_stack_pop(&s, &value), 0);
+    EXPECT_EQ(value, 59);
+
+    lf_fixed_stack_shutdown(&s);
+    EXPECT_EQ(lf_fixed_stack_push_n(&s, values, 1), -2);
+
+    lf_fixed_stack_destroy(&s);
+}
+
+TEST(stack_lock_free, magazines_keep_their_elements_when_the_shared_stack_is_full) {
+    lf_shared_stack s;
+    EXPECT_EQ(lf_shared_stack_create(&s), 0);
+
+    lf_shared_stack_magazine m;
+    lf_shared_stack_magazine_init(&m, &s);
+
+    // Leave room for only half a batch on the shared stack
+    for (int i = 0; i < 60; i++)
+        EXPECT_EQ(lf_shared_stack_push(&s, i), 0);
+
+    for (int i = 0; i < 16; i++)
+        EXPECT_EQ(lf_shared_stack_magazine_push(&m, 100 + i), 0);
+
+    EXPECT_EQ(lf_shared_stack_magazine_push(&m, 116), -1);
+    EXPECT_EQ(lf_shared_stack_magazine_flush(&m), -1);
+    EXPECT_EQ(lf_shared_stack_size(&s), 60u);
+
+    // Every element is in exactly one place
+    std::vector<int> all;
+    int value;
+    while (lf_shared_stack_pop(&s, &value) == 0)
+        all.push_back(value);
+    while (lf_shared_stack_magazine_pop(&m, &value) == 0)
+        all.push_back(value);
+
+    std::sort(all.begin(), all.end());
+    ASSERT_EQ(all.size(), (size_t) 76);
+    for (int i = 0; i < 60; i++)
+        EXPECT_EQ(all[i], i);
+    for (int i = 0; i < 16; i++)
+        EXPECT_EQ(all[60 + i], 100 + i);
+
+    lf_shared_stack_destroy(&s);
+}
+
+// Every thread pushes its own range of values, and pops whatever it finds, until everything is accounted for
+template <typename Stack, typename Push, typename Pop>
+static void contended_push_and_pop(Stack* s, Push push, Pop pop, const int values_per_thread) {
+    const int THREAD_COUNT = 16;
+    std::vector<std::vector<int>> popped(THREAD_COUNT);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        threads.emplace_back([&, t](){
+            for (int i = 0; i < values_per_thread; i++) {
+                // Retry while a fixed capacity stack is full
+                while (push(s, t * values_per_thread + i) == -1) {
+                    int value;
+                    if (pop(s, &value) == 0)
+                        popped[t].push_back(value);
+                }
+
+                if (i % 2) {
+                    int value;
+                    if (pop(s, &value) == 0)
+                        popped[t].push_back(value);
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // Collect what is left
+    std::vector<int> all;
+    int value;
+    while (pop(s, &value) == 0)
+        all.push_back(value);
+
+    for (const std::vector<int>& values : popped)
+        all.insert(all.end(), values.begin(), values.end());
+
+    std::sort(all.begin(), all.end());
+
+    ASSERT_EQ(all.size(), (size_t) THREAD_COUNT * values_per_thread);
+    for (int i = 0; i < THREAD_COUNT * values_per_thread; i++)
+        EXPECT_EQ(all[i], i);
+}
+
+TEST(stack_lock_free, contended_push_and_pop) {
+    lf_stack s;
+    EXPECT_EQ(lf_stack_create(&s, 0), 0);
+
+    contended_push_and_pop(&s, lf_stack_push, lf_stack_pop, 20000);
+
+    lf_stack_destroy(&s);
+}
+
+TEST(stack_lock_free, contended_push_and_pop_with_fixed_capacity) {
+    lf_fixed_stack s;
+    EXPECT_EQ(lf_fixed_stack_create(&s), 0);
+
+    contended_push_and_pop(&s, lf_fixed_stack_push, lf_fixed_stack_pop, 20000);
+
+    lf_fixed_stack_destroy(&s);
+}
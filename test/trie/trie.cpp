@@ -54,3 +54,23 @@ TEST(trie, basic_usage) {
 
     trie_destroy(trie);
 }
+
+TEST(trie, keys_longer_than_the_traversal_stack) {
+    struct trie_node* trie = trie_create();
+
+    // Every prefix of a long key, so the trie is deeper than the stack that `trie_destroy` starts out with
+    char key[201] = {};
+    uint16_t values[200];
+    for (int i = 0; i < 200; i++) {
+        key[i] = 'a' + i % 26;
+        values[i] = i;
+        trie_add(trie, key, &values[i]);
+    }
+
+    for (int i = 0; i < 200; i++) {
+        const std::string prefix(key, i + 1);
+        EXPECT_EQ(*(uint16_t*) trie_search(trie, prefix.c_str()), values[i]);
+    }
+
+    trie_destroy(trie);
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+extern "C" {
+    #include "ctools/uring.h"
+}
+
+// Skips the test when the kernel does not offer io_uring, e.g. inside restricted containers.
+#define INIT_OR_SKIP(ring, entries) \
+    if (ct_uring_init(ring, entries)) { \
+        EXPECT_TRUE(errno == ENOSYS || errno == EPERM); \
+        GTEST_SKIP() << "io_uring is not available"; \
+    }
+
+TEST(uring, fill_and_drain_through_a_pipe) {
+    struct ct_uring ring;
+    INIT_OR_SKIP(&ring, 8);
+
+    int pipe_in[2], pipe_out[2];
+    EXPECT_EQ(pipe(pipe_in), 0);
+    EXPECT_EQ(pipe(pipe_out), 0);
+
+    struct ct_cbuf circular_buffer;
+    EXPECT_EQ(ct_cbuf_init(&circular_buffer, 1), 0);
+
+    const unsigned int message_size = 3000;
+    unsigned char message[message_size], received[message_size];
+
+    for (int round = 0; round < 10; round++) {
+        for (unsigned int i = 0; i < message_size; i++)
+            message[i] = round + i;
+
+        struct ct_uring_op op;
+        struct ct_uring_op* done;
+
+        EXPECT_EQ(write(pipe_in[1], message, message_size), (ssize_t) message_size);
+
+        EXPECT_EQ(ct_uring_prep_fill(&ring, &op, &circular_buffer, pipe_in[0], -1), 0);
+        EXPECT_EQ(ct_uring_submit(&ring, 0), 1);
+        EXPECT_EQ(ct_uring_reap(&ring, &done, 1, 1), 1);
+        EXPECT_EQ(done, &op);
+        EXPECT_EQ(op.result, (int) message_size);
+        EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), message_size);
+
+        EXPECT_EQ(ct_uring_prep_drain(&ring, &op, &circular_buffer, pipe_out[1], -1), 0);
+        EXPECT_EQ(ct_uring_submit(&ring, 1), 1);
+        EXPECT_EQ(ct_uring_reap(&ring, &done, 1, 1), 1);
+        EXPECT_EQ(op.result, (int) message_size);
+        EXPECT_EQ(ct_cbuf_space_occupied(&circular_buffer), 0u);
+
+        EXPECT_EQ(read(pipe_out[0], received, message_size), (ssize_t) message_size);
+        EXPECT_EQ(memcmp(message, received, message_size), 0);
+    }
+
+    // Nothing can be queued from an empty buffer
+    struct ct_uring_op op;
+    EXPECT_EQ(ct_uring_prep_drain(&ring, &op, &circular_buffer, pipe_out[1], -1), -1);
+    EXPECT_EQ(errno, ENODATA);
+
+    close(pipe_in[0]);
+    close(pipe_in[1]);
+    close(pipe_out[0]);
+    close(pipe_out[1]);
+    ct_cbuf_exit(&circular_buffer);
+    ct_uring_exit(&ring);
+}
+
+TEST(uring, batched_transfers_with_registered_buffers) {
+    const unsigned int connection_count = 16;
+    const unsigned int message_size = 2500;
+
+    struct ct_uring ring;
+    INIT_OR_SKIP(&ring, connection_count);
+
+    int sockets[connection_count][2];
+    struct ct_cbuf buffers[connection_count];
+    struct ct_cbuf* buffer_ptrs[connection_count];
+    struct ct_uring_op ops[connection_count];
+    struct ct_uring_op* done[connection_count];
+
+    for (unsigned int i = 0; i < connection_count; i++) {
+        EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[i]), 0);
+        EXPECT_EQ(ct_cbuf_init(&buffers[i], 1), 0);
+        buffer_ptrs[i] = &buffers[i];
+    }
+
+    EXPECT_EQ(ct_uring_register_cbufs(&ring, buffer_ptrs, connection_count), 0);
+
+    unsigned char message[message_size], received[message_size];
+
+    for (int round = 0; round < 5; round++) {
+        // Every peer sends a message that identifies its connection
+        for (unsigned int i = 0; i < connection_count; i++) {
+            memset(message, round * connection_count + i, message_size);
+            EXPECT_EQ(write(sockets[i][0], message, message_size), (ssize_t) message_size);
+        }
+
+        // Read from all connections with a single submission
+        for (unsigned int i = 0; i < connection_count; i++)
+            EXPECT_EQ(ct_uring_prep_fill(&ring, &ops[i], &buffers[i], sockets[i][1], i), 0);
+
+        EXPECT_EQ(ct_uring_submit(&ring, 0), (int) connection_count);
+
+        unsigned int reaped = 0;
+        while (reaped < connection_count) {
+            int res = ct_uring_reap(&ring, done, connection_count, 1);
+            EXPECT_GT(res, 0);
+            reaped += res;
+        }
+
+        // Echo everything back with a single submission
+        for (unsigned int i = 0; i < connection_count; i++) {
+            EXPECT_EQ(ops[i].result, (int) message_size);
+            EXPECT_EQ(ct_uring_prep_drain(&ring, &ops[i], &buffers[i], sockets[i][1], i), 0);
+        }
+
+        EXPECT_EQ(ct_uring_submit(&ring, connection_count), (int) connection_count);
+        EXPECT_EQ(ct_uring_reap(&ring, done, connection_count, connection_count), (int) connection_count);
+
+        for (unsigned int i = 0; i < connection_count; i++) {
+            EXPECT_EQ(ops[i].result, (int) message_size);
+            EXPECT_EQ(ct_cbuf_space_occupied(&buffers[i]), 0u);
+
+            memset(message, round * connection_count + i, message_size);
+            EXPECT_EQ(read(sockets[i][0], received, message_size), (ssize_t) message_size);
+            EXPECT_EQ(memcmp(message, received, message_size), 0);
+        }
+    }
+
+    EXPECT_EQ(ct_uring_unregister_cbufs(&ring), 0);
+
+    for (unsigned int i = 0; i < connection_count; i++) {
+        close(sockets[i][0]);
+        close(sockets[i][1]);
+        ct_cbuf_exit(&buffers[i]);
+    }
+
+    ct_uring_exit(&ring);
+}